@@ -2,58 +2,111 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 
 #define WIDTH 1024
 #define HEIGHT 1024
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
+  Func output{"output"};
   Buffer<float> input;
-  Buffer<float> mask;
-  float sigma_s;
-
-  PipelineClass(Buffer<float> in, Buffer<float> mask, float sigma_s)
-      : input(in), mask(mask), sigma_s(sigma_s) {
+  MaskParam<float> mask;
+  // Read at every call, so changing it needs no recompilation
+  Param<float> sigma_s;
+  float default_sigma_s;
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<float> in, Buffer<float> mask, float sigma_s,
+                Boundary boundary)
+      : input(in), mask("mask", mask), sigma_s(tunable("sigma_s", sigma_s)),
+        default_sigma_s(sigma_s), boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input, boundary);
+    footprint = mask_footprint(mask);
     // Bilateral
     output(x, y) = Bilateral(gray)(x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input);
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<float> out = output_buffer<float>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input, mask.buffer(), default_sigma_s,
+                           Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    // Auto schedule the pipeline
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input.width(), input.height());
-
-    double best_auto = benchmark(10, 1, [&]() {
-      mask.copy_to_device(target); // include H2D copying time
-      input.copy_to_device(target);
-      p.realize(out);
+    auto run = [&]() {
+      copy_to_device(mask.buffer(), target); // include H2D copying time
+      copy_to_device(input, target);
+      runner.realize({out});
       out.copy_to_host(); // include D2H copying time
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    if (opts.param_sweep) {
+      int i = 0;
+      CacheBench sweep = run_cache_benchmark(opts, [&]() {
+        i++;
+        vary_params(i);
+        interior.vary_params(i);
+        run();
+      });
+      report_param_sweep(bench, sweep);
+    }
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
 
-    return true;
+    return time_ms;
+  }
+
+  // Move sigma_s off its default by step `i`, back at 0
+  void vary_params(int i) { sigma_s.set(default_sigma_s + 0.5f * (i % 8)); }
+
+  // Hand-written schedule: the two 13x13 sums are computed per output tile,
+  // vectorized across x with the taps outside
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output);
+    s.finish();
   }
 
 private:
@@ -64,8 +117,8 @@ private:
   Func Bilateral(Func f) {
     using Halide::_;
     Func d, p, out;
-    float c_r = 0.5f / (sigma_s * sigma_s);
-    RDom dom(mask); // a reduction domain of 13x13
+    Expr c_r = 0.5f / (sigma_s * sigma_s);
+    RDom dom = mask.domain(); // a reduction domain of 13x13
 
     Expr diff = f(x + dom.x, y + dom.y) - f(x, y);
     Expr sp = diff * diff * -c_r;
@@ -78,6 +131,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int sigma_s = 13;
@@ -124,14 +179,6 @@ int main(int argc, char **argv) {
        0.135335f, 0.128022f, 0.108368f, 0.082085f, 0.055638f, 0.033746f,
        0.018316f}};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> mask(sigma_s, sigma_s);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
@@ -140,9 +187,13 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask, sigma_s);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(opts, "Bilateral", input, [&]() {
+      return std::make_shared<PipelineClass>(input, mask, sigma_s,
+                                             input_boundary(opts));
+    });
   }
   return 0;
 }
@@ -0,0 +1,76 @@
+#include "Halide.h"
+#include "bench_harness.h"
+#include "object_cache.h"
+#include "schedule_cache.h"
+#include <iostream>
+
+using namespace Halide;
+using namespace HalideApps;
+
+// A blur with a runtime weight and a tiled, vectorized schedule, built from
+// unnamed Funcs, Vars, RDoms and Params so that all their names are
+// generated
+Func build_blur(const Buffer<float> &input) {
+  Var x, y, xo, yo, xi, yi;
+  RDom r(-1, 3);
+  Param<float> weight;
+  weight.set(0.5f);
+  Func clamped = BoundaryConditions::repeat_edge(input);
+  Func blur_x, blur_y;
+  blur_x(x, y) = 0.0f;
+  blur_x(x, y) += clamped(x + r, y) * weight;
+  blur_y(x, y) = 0.0f;
+  blur_y(x, y) += blur_x(x, y + r) / 3;
+  blur_y.tile(x, y, xo, yo, xi, yi, 64, 16).parallel(yo).vectorize(xi, 8);
+  blur_x.compute_at(blur_y, xo).vectorize(x, 8);
+  return blur_y;
+}
+
+struct CacheKeys {
+  std::string pipeline, schedule, object;
+};
+
+CacheKeys cache_keys(const Buffer<float> &input, const Target &target) {
+  Func f = build_blur(input);
+  Pipeline p(f);
+  CacheKeys k;
+  k.pipeline = pipeline_hash({f});
+  k.schedule = serialize_schedule({f});
+  k.object = object_cache_key(p, p.infer_arguments(), target,
+                              object_cache_dir());
+  return k;
+}
+
+// Checks that the schedule and object cache keys of a pipeline do not
+// depend on the Halide objects the process built before it: builds the same
+// pipeline twice, with other Funcs, Vars and RDoms built in between, and
+// compares the keys. Exits with 1 if they differ.
+int main() {
+  Target target = get_host_target();
+  if (!make_dirs(object_cache_dir())) {
+    return 1;
+  }
+  Buffer<float> input(256, 256);
+  input.fill(1.0f);
+
+  CacheKeys first = cache_keys(input, target);
+  for (int i = 0; i < 5; i++) {
+    Var x, y;
+    RDom r(0, 2);
+    Func other;
+    other(x, y) = x + y;
+    other(x, y) += r;
+  }
+  CacheKeys second = cache_keys(input, target);
+
+  bool same = true;
+  auto check = [&](const char *name, const std::string &a,
+                   const std::string &b) {
+    printf("%s key: %s\n", name, a == b ? "same" : "differs");
+    same = same && a == b;
+  };
+  check("Pipeline", first.pipeline, second.pipeline);
+  check("Schedule", first.schedule, second.schedule);
+  check("Object", first.object, second.object);
+  return same ? 0 : 1;
+}
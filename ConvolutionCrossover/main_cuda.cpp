@@ -0,0 +1,48 @@
+#include "Halide.h"
+#include "app_target.h"
+#include "bench_harness.h"
+#include "fft_convolution.h"
+#include "halide_benchmark.h"
+#include <iostream>
+#include <limits>
+
+#define WIDTH 1024
+#define HEIGHT 1024
+
+using namespace Halide;
+using namespace Halide::Tools;
+using namespace HalideApps;
+
+// Times direct (RDom) and FFT convolution of a float image over a range of
+// square mask sizes, reports the mask size from which the FFT path wins and
+// stores it as the crossover the apps use for --conv=auto.
+int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
+  // The sizes fft_crossover() measures, so this sweep and the crossover the
+  // apps measure on first use agree
+  const std::vector<int> sizes = fft_crossover_sizes();
+
+  Target target = app_target(opts);
+
+  printf("Running convolution sweep on %dx%d...\n", WIDTH, HEIGHT);
+  std::vector<ConvTiming> timings =
+      measure_conv_timings(target, sizes, WIDTH, HEIGHT);
+
+  printf("| mask  | direct (ms) | FFT (ms) |\n");
+  printf("|:----- | -----------:| --------:|\n");
+  for (const ConvTiming &t : timings) {
+    printf("| %2dx%-2d | %11.4f | %8.4f |\n", t.mask_size, t.mask_size,
+           t.direct_ms, t.fft_ms);
+  }
+
+  int crossover = crossover_from_timings(timings);
+  if (crossover > 0) {
+    printf("FFT convolution wins from %dx%d masks\n", crossover, crossover);
+  } else {
+    printf("FFT convolution never wins up to %dx%d masks\n", sizes.back(),
+           sizes.back());
+  }
+  store_fft_crossover(target, crossover);
+  return 0;
+}
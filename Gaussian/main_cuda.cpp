@@ -1,5 +1,19 @@
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "client_bench.h"
+#include "fft_convolution.h"
+#include "frame_stream.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
+#include "spin_pool.h"
 #include <iostream>
 #include <limits>
 
@@ -8,49 +22,92 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
-  Func blur_x;
-  Buffer<float> input;
+  Func output{"output"};
+  Func blur_x{"blur_x"};
+  BufferParam<float> input;
   Buffer<float> maskGaus;
-
-  PipelineClass(Buffer<float> in, Buffer<float> mask)
-      : input(in), maskGaus(mask) {
+  bool use_fft;
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<float> in, Buffer<float> mask, bool use_fft,
+                Boundary boundary)
+      : input("input", in), maskGaus(mask), use_fft(use_fft),
+        boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input.param(), boundary);
+    footprint = use_fft ? fft_footprint(maskGaus) : mask_footprint(maskGaus);
     // Gaussian
     output(x, y) = GaussBlur(gray)(x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input.buffer());
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<float> out = output_buffer<float>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input.buffer(), maskGaus, use_fft, Boundary::None);
+    if (mode.manual) {
+      if (!schedule_manual(target, mode.params)) {
+        printf("No manual schedule for FFT convolution\n");
+        return -1;
+      }
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
-    // target.set_feature(Target::Profile); // Enable debug info
-
-    // Auto schedule the pipeline
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input.width(), input.height());
-
-    double best_auto = benchmark(10, 3, [&]() {
-      maskGaus.copy_to_device(target); // include H2D copying time
-      input.copy_to_device(target);
-      p.realize(out);
+    auto run = [&]() {
+      copy_to_device(maskGaus, target); // include H2D copying time
+      copy_to_device(input.buffer(), target);
+      runner.realize({out});
       out.copy_to_host(); // include D2H copying time
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+    stream_frames<float, float>(opts, target, runner,
+                                {&input, &interior.input});
+    run_clients(opts, target, runner, {out});
+    compare_thread_pools(
+        opts, target,
+        [&](halide_do_par_for_t f) { runner.set_do_par_for(f); },
+        [&]() { runner.realize({out}); });
+
+    return time_ms;
+  }
 
+  // Hand-written schedule: the direct convolution is computed per output
+  // tile, vectorized across x with the taps outside. The FFT path has none.
+  bool schedule_manual(const Target &t, const ScheduleParams &params) {
+    if (use_fft) {
+      return false;
+    }
+    ManualSchedule s(t, params);
+    s.output(output);
+    s.finish();
     return true;
   }
 
@@ -58,8 +115,11 @@ private:
   Var x, y;
   Target target;
 
-  // 3x3 Gaussian filter
+  // 3x3 Gaussian filter, through the frequency domain for large masks
   Func GaussBlur(Func f) {
+    if (use_fft) {
+      return fft_correlate(f, maskGaus, "gauss_fft");
+    }
     using Halide::_;
     Func blur;
     RDom dom(maskGaus);
@@ -70,6 +130,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -79,25 +141,50 @@ int main(int argc, char **argv) {
   const float coef[3][3] = {0.057118f, 0.124758f, 0.057118f, 0.124758f, 0.272496f,
                             0.124758f, 0.057118f, 0.124758f, 0.057118f};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
       mask(x, y) = coef[x][y];
     }
   }
+  if (opts.mask_size) {
+    // Sampled Gaussian spanning +-3 sigma
+    const int size = opts.mask_size;
+    const float sigma = size / 6.0f;
+    float sum = 0.0f;
+    mask = Buffer<float>(size, size);
+    for (int y = 0; y < mask.height(); y++) {
+      for (int x = 0; x < mask.width(); x++) {
+        float dx = x - (size - 1) / 2.0f;
+        float dy = y - (size - 1) / 2.0f;
+        mask(x, y) = expf(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+        sum += mask(x, y);
+      }
+    }
+    for (int y = 0; y < mask.height(); y++) {
+      for (int x = 0; x < mask.width(); x++) {
+        mask(x, y) /= sum;
+      }
+    }
+  }
+
+  Target target = app_target(opts);
+  bool use_fft = use_fft_convolution(opts.conv, mask.width(), mask.height(),
+                                     target);
+  printf("%dx%d mask, %s convolution\n", mask.width(), mask.height(),
+         use_fft ? "FFT" : "direct");
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(
+        opts, "Gaussian", input,
+        [&]() {
+          return std::make_shared<PipelineClass>(input, mask, use_fft,
+                                                 input_boundary(opts));
+        },
+        true, !use_fft);
   }
   return 0;
 }
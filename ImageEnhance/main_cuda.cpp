@@ -1,5 +1,16 @@
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "frame_parallel.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 #include <iostream>
 #include <limits>
 
@@ -9,19 +20,31 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
   Func output[PARN];
   Func avgImg[PARN];
   Buffer<float> input;
-  Buffer<float> maskAvg;
-  int gain = 2;
-  float gamma = 0.6;
-
-  PipelineClass(Buffer<float> in, Buffer<float> mask) : input(in), maskAvg(mask) {
+  MaskParam<float> maskAvg;
+  // Read at every call, so changing them needs no recompilation
+  Param<int> gain = tunable("gain", 2);
+  Param<float> gamma = tunable("gamma", 0.6f);
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<float> in, Buffer<float> mask, Boundary boundary)
+      : input(in), maskAvg("maskAvg", mask), boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input, boundary);
+    footprint = mask_footprint(maskAvg.buffer());
+
+    // Name the stages, for profiles
+    for (int n = 0; n < PARN; n++) {
+      avgImg[n] = Func("avgImg" + std::to_string(n));
+      output[n] = Func("output" + std::to_string(n));
+    }
 
     // Average Filter
     for (int n = 0; n < PARN; n++) {
@@ -34,44 +57,48 @@ public:
     }
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // The outputs cover just the region the pipeline produces: the interior
+    // for "valid" output
+    Rect full = buffer_rect(input);
+    Rect region = output_region(full, boundary, footprint);
+    auto image = [&]() { return output_buffer<float>(region, opts.pad); };
+    Buffer<float> out0 = image();
+    Buffer<float> out1 = image();
+    Buffer<float> out2 = image();
+    Buffer<float> out3 = image();
+    Buffer<float> out4 = image();
+    Buffer<float> out5 = image();
+    Buffer<float> out6 = image();
+    Buffer<float> out7 = image();
+    Buffer<float> out8 = image();
+    Buffer<float> out9 = image();
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, std::vector<Func>(output, output + PARN),
+                          region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input, maskAvg.buffer(), Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    // Auto schedule the pipeline
-    for (int n = 0; n < PARN; n++) {
-      output[n].set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    }
-    Pipeline p({output[0], output[1], output[2], output[3], output[4], output[5],
-                output[6], output[7], output[8], output[9]});
-    p.auto_schedule(target);
-    for (int n = 0; n < PARN; n++) {
-      output[n].compile_jit(target);
+    if (mode.split) {
+      runner.split(std::vector<Func>(interior.output, interior.output + PARN),
+                   interior_rect(full, footprint));
     }
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<float> out0(input.width(), input.height());
-    Buffer<float> out1(input.width(), input.height());
-    Buffer<float> out2(input.width(), input.height());
-    Buffer<float> out3(input.width(), input.height());
-    Buffer<float> out4(input.width(), input.height());
-    Buffer<float> out5(input.width(), input.height());
-    Buffer<float> out6(input.width(), input.height());
-    Buffer<float> out7(input.width(), input.height());
-    Buffer<float> out8(input.width(), input.height());
-    Buffer<float> out9(input.width(), input.height());
+    runner.compile();
 
     // Timing code
-    double best_auto = benchmark(10, 3, [&]() {
-      maskAvg.copy_to_device(target);
-      input.copy_to_device(target);
-      p.realize({out0, out1, out2, out3, out4, out5, out6, out7, out8, out9});
+    auto run = [&]() {
+      copy_to_device(maskAvg.buffer(), target);
+      copy_to_device(input, target);
+      runner.realize(
+          {out0, out1, out2, out3, out4, out5, out6, out7, out8, out9});
       out0.copy_to_host();
       out1.copy_to_host();
       out2.copy_to_host();
@@ -93,10 +120,48 @@ public:
       out7.device_sync();
       out8.device_sync();
       out9.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    if (opts.param_sweep) {
+      int i = 0;
+      CacheBench sweep = run_cache_benchmark(opts, [&]() {
+        i++;
+        vary_params(i);
+        interior.vary_params(i);
+        run();
+      });
+      report_param_sweep(bench, sweep);
+    }
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs(
+        {out0, out1, out2, out3, out4, out5, out6, out7, out8, out9}, time_ms);
+    run_frame_parallel(
+        opts, target, runner,
+        {out0, out1, out2, out3, out4, out5, out6, out7, out8, out9});
+
+    return time_ms;
+  }
 
-    return true;
+  // Move gain and gamma off their defaults by step `i`, back at 0
+  void vary_params(int i) {
+    gain.set(2 + i % 2);
+    gamma.set(0.6f + 0.05f * (i % 8));
+  }
+
+  // Hand-written schedule: every output is tiled on its own with its
+  // average computed per tile
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    for (int n = 0; n < PARN; n++) {
+      s.output(output[n]);
+    }
+    s.finish();
   }
 
 private:
@@ -107,7 +172,7 @@ private:
   Func AverageFilter(Func f) {
     using Halide::_;
     Func avg;
-    RDom dom(maskAvg); // a reduction domain of 3x3
+    RDom dom = maskAvg.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * maskAvg(dom.x, dom.y);
     avg(x, y) += conv;
     return avg;
@@ -115,6 +180,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -125,14 +192,6 @@ int main(int argc, char **argv) {
                                          0.111111f, 0.111111f, 0.111111f,
                                          0.111111f, 0.111111f, 0.111111f};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
@@ -141,9 +200,12 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(opts, "ImageEnhance", input, [&]() {
+      return std::make_shared<PipelineClass>(input, mask, input_boundary(opts));
+    });
   }
   return 0;
 }
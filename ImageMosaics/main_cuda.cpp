@@ -2,7 +2,16 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
 
 #define WIDTH 512
 #define HEIGHT 512
@@ -10,10 +19,11 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
+  Func output{"output"};
   Func gPyramid1[LEVEL];
   Func gPyramid2[LEVEL];
   Func lPyramid1[LEVEL];
@@ -23,12 +33,24 @@ public:
   Buffer<float> input1;
   Buffer<float> input2;
   Buffer<float> mask;
+  Boundary boundary;
 
-  PipelineClass(Buffer<float> in1, Buffer<float> in2, Buffer<float> mask)
-      : input1(in1), input2(in2), mask(mask) {
+  PipelineClass(Buffer<float> in1, Buffer<float> in2, Buffer<float> mask,
+                Boundary boundary)
+      : input1(in1), input2(in2), mask(mask), boundary(boundary) {
     // Set a boundary condition
-    Func gray1 = BoundaryConditions::repeat_edge(input1);
-    Func gray2 = BoundaryConditions::repeat_edge(input2);
+    Func gray1 = guard_input(input1, boundary);
+    Func gray2 = guard_input(input2, boundary);
+
+    // Name the stages, for profiles
+    for (int j = 0; j < LEVEL; j++) {
+      gPyramid1[j] = Func("gPyramid1" + std::to_string(j));
+      gPyramid2[j] = Func("gPyramid2" + std::to_string(j));
+      lPyramid1[j] = Func("lPyramid1" + std::to_string(j));
+      lPyramid2[j] = Func("lPyramid2" + std::to_string(j));
+      lPyramid[j] = Func("lPyramid" + std::to_string(j));
+      outLPyramid[j] = Func("outLPyramid" + std::to_string(j));
+    }
 
     // Make the Gaussian pyramid of the input 1
     gPyramid1[0](x, y) = gray1(x, y);
@@ -66,36 +88,61 @@ public:
     output(x, y) = outLPyramid[0](x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
-    }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-
-    // Auto schedule the pipeline
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
 
     // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input1.width(), input1.height());
-    double best_auto = benchmark(10, 3, [&]() {
-      mask.copy_to_device(target); // include H2D copying time
-      input1.copy_to_device(target);
-      input2.copy_to_device(target);
-      p.realize(out);
+    Buffer<float> out =
+        padded_buffer<float>(input1.width(), input1.height(), opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. Every output pixel
+    // reads most of the coarsest level, so there is no unguarded interior to
+    // split off.
+    PipelineRunner runner(opts, target, {output}, buffer_rect(out));
+    runner.set_build_ms(mode.build_ms);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
+    }
+    runner.compile();
+    auto run = [&]() {
+      copy_to_device(mask, target); // include H2D copying time
+      copy_to_device(input1, target);
+      copy_to_device(input2, target);
+      runner.realize({out});
       out.copy_to_host(); // include D2H copying time
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+
+    return time_ms;
+  }
 
-    return true;
+  // Hand-written schedule: every pyramid level is computed at root, tiled
+  // and parallel on its own, since coarser levels are read at every pixel of
+  // finer ones. The two Laplacian pyramids are inlined into their merge, the
+  // downsampling blurs go in the tiles of the level that reads them, and
+  // upsampling is inlined.
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output);
+    for (int j = 1; j < LEVEL; j++) {
+      s.producer(gPyramid1[j], ComputeLevel::Root)
+          .producer(gPyramid2[j], ComputeLevel::Root)
+          .producer(outLPyramid[j], ComputeLevel::Root);
+    }
+    for (int j = 0; j < LEVEL; j++) {
+      s.producer(lPyramid[j], ComputeLevel::Root);
+    }
+    s.finish();
   }
 
 private:
@@ -132,6 +179,12 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
+  if (input_boundary(opts) == Boundary::None) {
+    fprintf(stderr, "Pyramid pipelines have no valid-only region\n");
+    return 1;
+  }
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -142,16 +195,6 @@ int main(int argc, char **argv) {
                                       0.124758f, 0.272496f, 0.124758f,
                                       0.057118f, 0.124758f, 0.057118f};
 
-  // Initialize with random image
-  Buffer<float> input1(width, height);
-  Buffer<float> input2(width, height);
-  for (int y = 0; y < input1.height(); y++) {
-    for (int x = 0; x < input1.width(); x++) {
-      input1(x, y) = rand() & 0xfff;
-      input2(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
@@ -160,9 +203,19 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input1, input2, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input images, or generated ones of this kind
+    Buffer<float> input1 =
+        app_input<float>(opts, kind, width, height, 0xfff, 0);
+    Buffer<float> input2 =
+        app_input<float>(opts, kind, width, height, 0xfff, 1);
+    run_app_modes(
+        opts, "ImageMosaics", input1,
+        [&]() {
+          return std::make_shared<PipelineClass>(input1, input2, mask,
+                                                 input_boundary(opts));
+        },
+        false);
   }
   return 0;
 }
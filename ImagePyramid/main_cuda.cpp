@@ -2,7 +2,16 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
 
 #define WIDTH 512
 #define HEIGHT 512
@@ -10,10 +19,11 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
+  Func output{"output"};
   Func gPyramid[LEVEL];
   Func lPyramid[LEVEL];
   Func outLPyramid[LEVEL];
@@ -22,12 +32,22 @@ public:
   Buffer<float> mask;
   Buffer<float> maskGaus;
   float sigma_s;
+  Boundary boundary;
 
   PipelineClass(Buffer<float> in, Buffer<float> msk, Buffer<float> mskg,
-                float sigma_s)
-      : input(in), mask(msk), maskGaus(mskg), sigma_s(sigma_s) {
+                float sigma_s, Boundary boundary)
+      : input(in), mask(msk), maskGaus(mskg), sigma_s(sigma_s),
+        boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input, boundary);
+
+    // Name the stages, for profiles
+    for (int j = 0; j < LEVEL; j++) {
+      gPyramid[j] = Func("gPyramid" + std::to_string(j));
+      lPyramid[j] = Func("lPyramid" + std::to_string(j));
+      BLPyramid[j] = Func("BLPyramid" + std::to_string(j));
+      outLPyramid[j] = Func("outLPyramid" + std::to_string(j));
+    }
 
     // Make the Gaussian pyramid of the input
     gPyramid[0](x, y) = gray(x, y);
@@ -56,36 +76,60 @@ public:
     output(x, y) = outLPyramid[0](x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
-    }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-
-    // Auto schedule the pipeline
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
 
     // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input.width(), input.height());
-    double best_auto = benchmark(10, 3, [&]() {
-      maskGaus.copy_to_device(target); // include H2D copying time
-      mask.copy_to_device(target);
-      input.copy_to_device(target);
-      p.realize(out);
+    Buffer<float> out =
+        padded_buffer<float>(input.width(), input.height(), opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. Every output pixel
+    // reads most of the coarsest level, so there is no unguarded interior to
+    // split off.
+    PipelineRunner runner(opts, target, {output}, buffer_rect(out));
+    runner.set_build_ms(mode.build_ms);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
+    }
+    runner.compile();
+    auto run = [&]() {
+      copy_to_device(maskGaus, target); // include H2D copying time
+      copy_to_device(mask, target);
+      copy_to_device(input, target);
+      runner.realize({out});
       out.copy_to_host(); // include D2H copying time
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
 
-    return true;
+    return time_ms;
+  }
+
+  // Hand-written schedule: every pyramid level is computed at root, tiled
+  // and parallel on its own, since coarser levels are read at every pixel of
+  // finer ones. The downsampling blurs and the bilateral sums go in the tiles
+  // of the level that reads them; upsampling is inlined.
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output);
+    for (int j = 1; j < LEVEL; j++) {
+      s.producer(gPyramid[j], ComputeLevel::Root)
+          .producer(BLPyramid[j], ComputeLevel::Root)
+          .producer(outLPyramid[j], ComputeLevel::Root);
+    }
+    for (int j = 0; j < LEVEL - 1; j++) {
+      s.producer(lPyramid[j], ComputeLevel::Root);
+    }
+    s.finish();
   }
 
 private:
@@ -130,6 +174,12 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
+  if (input_boundary(opts) == Boundary::None) {
+    fprintf(stderr, "Pyramid pipelines have no valid-only region\n");
+    return 1;
+  }
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -182,14 +232,6 @@ int main(int argc, char **argv) {
        0.135335f, 0.128022f, 0.108368f, 0.082085f, 0.055638f, 0.033746f,
        0.018316f}};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> maskg(size_x, size_y);
   for (int y = 0; y < maskg.height(); y++) {
     for (int x = 0; x < maskg.width(); x++) {
@@ -204,9 +246,16 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, maskb, maskg, sigma_s);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(
+        opts, "ImagePyramid", input,
+        [&]() {
+          return std::make_shared<PipelineClass>(input, maskb, maskg, sigma_s,
+                                                 input_boundary(opts));
+        },
+        false);
   }
   return 0;
 }
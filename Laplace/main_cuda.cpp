@@ -1,5 +1,17 @@
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "fft_convolution.h"
+#include "frame_stream.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 #include <iostream>
 #include <limits>
 
@@ -10,16 +22,24 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func intermBuf;
-  Func output;
-  Buffer<DTYPE> input;
+  Func intermBuf{"intermBuf"};
+  Func output{"output"};
+  BufferParam<DTYPE> input;
   Buffer<float> maskDoG;
-
-  PipelineClass(Buffer<DTYPE> in, Buffer<float> mask) : input(in), maskDoG(mask) {
-    Func gray = BoundaryConditions::repeat_edge(input);
+  bool use_fft;
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<DTYPE> in, Buffer<float> mask, bool use_fft,
+                Boundary boundary)
+      : input("input", in), maskDoG(mask), use_fft(use_fft),
+        boundary(boundary) {
+    Func gray = guard_input(input.param(), boundary);
+    footprint = use_fft ? fft_footprint(maskDoG) : mask_footprint(maskDoG);
     intermBuf(x, y) = Laplace(gray)(x, y);
     intermBuf(x, y) = intermBuf(x, y) + 128.0f;
     intermBuf(x, y) =
@@ -29,35 +49,64 @@ public:
     output(x, y) = cast<DTYPE>(intermBuf(x, y));
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input.buffer());
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<DTYPE> out = output_buffer<DTYPE>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input.buffer(), maskDoG, use_fft, Boundary::None);
+    if (mode.manual) {
+      if (!schedule_manual(target, mode.params)) {
+        printf("No manual schedule for FFT convolution\n");
+        return -1;
+      }
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-
-    // Auto schedule the pipeline
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<DTYPE> out(input.width(), input.height());
-
-    maskDoG.copy_to_device(target);
-    input.copy_to_device(target);
-    double best_auto = benchmark(10, 3, [&]() {
-      p.realize(out);
+    copy_to_device(maskDoG, target);
+    copy_to_device(input.buffer(), target);
+    auto run = [&]() {
+      runner.realize({out});
       // out.copy_to_host();
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+    stream_frames<DTYPE, DTYPE>(opts, target, runner,
+                                {&input, &interior.input}, 255);
+
+    return time_ms;
+  }
 
+  // Hand-written schedule: the convolution and the clamps on it are computed
+  // per output tile. The FFT path has none.
+  bool schedule_manual(const Target &t, const ScheduleParams &params) {
+    if (use_fft) {
+      return false;
+    }
+    ManualSchedule s(t, params);
+    s.output(output).producer(intermBuf, ComputeLevel::Tile);
+    s.finish();
     return true;
   }
 
@@ -66,6 +115,9 @@ private:
   Target target;
 
   Func Laplace(Func f) {
+    if (use_fft) {
+      return fft_correlate(f, maskDoG, "laplace_fft");
+    }
     using Halide::_;
     Func blur;
     RDom dom(maskDoG); // a reduction domain
@@ -76,6 +128,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 5;
@@ -85,25 +139,37 @@ int main(int argc, char **argv) {
   const float coef[size_x][size_y] = {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -24,
                                       1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
 
-  // Initialize with random image
-  Buffer<DTYPE> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = (DTYPE)((rand()) % 256);
-    }
-  }
-
   Buffer<float> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
       mask(x, y) = coef[x][y];
     }
   }
+  if (opts.mask_size) {
+    // Same shape as above: ones around a center that balances them
+    const int size = opts.mask_size;
+    mask = Buffer<float>(size, size);
+    mask.fill(1.0f);
+    mask(size / 2, size / 2) = 1.0f - size * size;
+  }
+
+  Target target = app_target(opts);
+  bool use_fft = use_fft_convolution(opts.conv, mask.width(), mask.height(),
+                                     target);
+  printf("%dx%d mask, %s convolution\n", mask.width(), mask.height(),
+         use_fft ? "FFT" : "direct");
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<DTYPE> input = app_input<DTYPE>(opts, kind, width, height, 255);
+    run_app_modes(
+        opts, "Laplace", input,
+        [&]() {
+          return std::make_shared<PipelineClass>(input, mask, use_fft,
+                                                 input_boundary(opts));
+        },
+        true, !use_fft);
   }
   return 0;
 }
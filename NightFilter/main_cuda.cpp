@@ -1,5 +1,16 @@
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "frame_stream.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 #include <iostream>
 #include <limits>
 
@@ -8,25 +19,31 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
-  Func intermBuf3;
-  Func intermBuf5;
-  Func intermBuf9;
-  Func intermBuf17;
-  Buffer<uint> input;
+  Func output{"output"};
+  Func intermBuf3{"intermBuf3"};
+  Func intermBuf5{"intermBuf5"};
+  Func intermBuf9{"intermBuf9"};
+  Func intermBuf17{"intermBuf17"};
+  BufferParam<uint> input;
   Buffer<float> mask3;
   Buffer<float> mask5;
   Buffer<float> mask9;
   Buffer<float> mask17;
+  Boundary boundary;
+  Footprint footprint;
 
   PipelineClass(Buffer<uint> in, Buffer<float> msk3, Buffer<float> msk5,
-                Buffer<float> msk9, Buffer<float> msk17)
-      : input(in), mask3(msk3), mask5(msk5), mask9(msk9), mask17(msk17) {
+                Buffer<float> msk9, Buffer<float> msk17, Boundary boundary)
+      : input("input", in), mask3(msk3), mask5(msk5), mask9(msk9),
+        mask17(msk17), boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input.param(), boundary);
+    footprint = mask_footprint(mask3) + mask_footprint(mask5) +
+                mask_footprint(mask9) + mask_footprint(mask17);
 
     // Astrous Filter (Iteratively)
     intermBuf3(x, y) = AtrousFilter(gray, mask3)(x, y);
@@ -38,38 +55,67 @@ public:
     output(x, y) = Scoto(intermBuf17)(x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input.buffer());
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<uint> out = output_buffer<uint>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input.buffer(), mask3, mask5, mask9, mask17,
+                           Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    // Auto schedule the pipeline
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<uint> out(input.width(), input.height());
-
-    mask3.copy_to_device(target);
-    mask5.copy_to_device(target);
-    mask9.copy_to_device(target);
-    mask17.copy_to_device(target);
-    input.copy_to_device(target);
-    double best_auto = benchmark(10, 3, [&]() {
-      p.realize(out);
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
+
+    copy_to_device(mask3, target);
+    copy_to_device(mask5, target);
+    copy_to_device(mask9, target);
+    copy_to_device(mask17, target);
+    copy_to_device(input.buffer(), target);
+    auto run = [&]() {
+      runner.realize({out});
       out.copy_to_host();
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+    stream_frames<uint, uint>(opts, target, runner,
+                              {&input, &interior.input});
+
+    return time_ms;
+  }
 
-    return true;
+  // Hand-written schedule: each a-trous pass reads a dilated window of the
+  // previous one, so the first three are computed at root rather than
+  // recomputed over the halos of every tile. The last is computed per
+  // output tile with the color conversion inlined.
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output)
+        .producer(intermBuf3, ComputeLevel::Root)
+        .producer(intermBuf5, ComputeLevel::Root)
+        .producer(intermBuf9, ComputeLevel::Root);
+    s.finish();
   }
 
 private:
@@ -190,6 +236,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
 
@@ -250,14 +298,6 @@ int main(int argc, char **argv) {
       0.124758f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
       0.057118f};
 
-  // Initialize with random image
-  Buffer<uint> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   // masks
   Buffer<float> mask3(3, 3);
   for (int y = 0; y < mask3.height(); y++) {
@@ -285,9 +325,13 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask3, mask5, mask9, mask17);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<uint> input = app_input<uint>(opts, kind, width, height);
+    run_app_modes(opts, "NightFilter", input, [&]() {
+      return std::make_shared<PipelineClass>(input, mask3, mask5, mask9, mask17,
+                                             input_boundary(opts));
+    });
   }
   return 0;
 }
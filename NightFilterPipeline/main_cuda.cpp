@@ -1,5 +1,15 @@
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "frame_parallel.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
 #include <iostream>
 #include <limits>
 
@@ -9,6 +19,7 @@
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 using std::vector;
 
 class PipelineClass {
@@ -18,10 +29,20 @@ public:
   Func bufOut[NPIPE];
   Buffer<uint> input;
   Buffer<float> mask;
+  Boundary boundary;
+  Footprint footprint;
 
-  PipelineClass(Buffer<uint> in, Buffer<float> mask) : input(in), mask(mask) {
+  PipelineClass(Buffer<uint> in, Buffer<float> mask, Boundary boundary)
+      : input(in), mask(mask), boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input, boundary);
+    footprint = mask_footprint(mask);
+
+    // Name the stages, for profiles
+    for (int n = 0; n < NPIPE; n++) {
+      bufImg[n] = Func("bufImg" + std::to_string(n));
+      bufOut[n] = Func("bufOut" + std::to_string(n));
+    }
 
     // Atrous Filter
     for (int n = 0; n < NPIPE; n++) {
@@ -37,48 +58,67 @@ public:
     }
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
-    }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    // Auto schedule the pipeline
-    for (int n = 0; n < NPIPE; n++) {
-      output[n].set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    }
-    Pipeline p(output);
-    p.auto_schedule(target);
-    for (int n = 0; n < NPIPE; n++) {
-      output[n].compile_jit(target);
-    }
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
 
-    // Test the performance of the scheduled pipeline.
+    // Test the performance of the scheduled pipeline, into outputs of just
+    // the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input);
+    Rect region = output_region(full, boundary, footprint);
     std::vector<Buffer<>> outputBufs;
     for (int n = 0; n < NPIPE; n++) {
-      Buffer<uint> out(input.width(), input.height());
+      Buffer<uint> out = output_buffer<uint>(region, opts.pad);
       outputBufs.push_back(out);
     }
 
-    Realization r(outputBufs);
-    double best_auto = benchmark(10, 3, [&]() {
-      mask.copy_to_device(target); // include H2D copying time
-      input.copy_to_device(target);
-      p.realize(r);
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, output, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input, mask, Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
+    }
+    if (mode.split) {
+      runner.split(interior.output, interior_rect(full, footprint));
+    }
+    runner.compile();
+
+    auto run = [&]() {
+      copy_to_device(mask, target); // include H2D copying time
+      copy_to_device(input, target);
+      runner.realize(outputBufs);
       for (int n = 0; n < NPIPE; n++) { // include D2H copying time
         outputBufs[n].copy_to_host();
       }
       for (int n = 0; n < NPIPE; n++) {
         outputBufs[n].device_sync();
       }
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs(outputBufs, time_ms);
+    run_frame_parallel(opts, target, runner, outputBufs);
+
+    return time_ms;
+  }
 
-    return true;
+  // Hand-written schedule: every output is tiled on its own with its
+  // a-trous sums computed per tile
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    for (Func &f : output) {
+      s.output(f);
+    }
+    s.finish();
   }
 
 private:
@@ -199,6 +239,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 9;
@@ -216,14 +258,6 @@ int main(int argc, char **argv) {
       0.0f,      0.0f, 0.0f, 0.0f, 0.0f,      0.0f, 0.0f, 0.0f, 0.0f,
       0.057118f, 0.0f, 0.0f, 0.0f, 0.124758f, 0.0f, 0.0f, 0.0f, 0.057118f};
 
-  // Initialize with random image
-  Buffer<uint> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<float> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
@@ -232,9 +266,12 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<uint> input = app_input<uint>(opts, kind, width, height);
+    run_app_modes(opts, "NightFilterPipeline", input, [&]() {
+      return std::make_shared<PipelineClass>(input, mask, input_boundary(opts));
+    });
   }
   return 0;
 }
@@ -2,43 +2,43 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_options.h"
+#include "app_target.h"
+#include "autoscheduler.h"
+#include "bench_harness.h"
 #include "halide_benchmark.h"
+#include "manual_schedule.h"
+#include "spin_pool.h"
 
 #define WIDTH 65536
-#define USE_AUTO
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
   Func output;
   Buffer<int> input;
 
-  PipelineClass(Buffer<int> in) : input(in) {
+  PipelineClass(Buffer<int> in) : input(in), r(0, WIDTH) {
     // Parallel reduction: summation
     output() = 0;
-    RDom r(0, WIDTH);
     output() = output() + input(r.x);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
-    }
+  bool test_performance(const AppOptions &opts, bool manual) {
+    target = app_target(opts);
 
-#ifdef USE_AUTO
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-    printf("Using auto-scheduler...\n");
-#else
-    output.compute_root();
+    if (manual) {
+      schedule_manual(target);
+      printf("Using hand-written schedule...\n");
+    } else {
+      Pipeline p(output);
+      run_autoscheduler(p, target, opts);
+      printf("Using auto-scheduler...\n");
+    }
     output.compile_jit(target);
-    printf("Computing from root...\n");
-#endif
 
     // The equivalent C is:
     int c_ref = 0;
@@ -46,23 +46,65 @@ public:
       c_ref += input(y);
     }
 
-    input.copy_to_device(target);
-    double best_time = benchmark(10, 5, [&]() {
-      Buffer<int> out = output.realize();
+    copy_to_device(input, target);
+    Buffer<int> out;
+    CacheBench bench = run_cache_benchmark(opts, [&]() {
+      out = output.realize();
       out.copy_to_host();
       out.device_sync();
     });
-    printf("Halide time (best): %gms\n", best_time * 1e3);
+    printf("%s time (median): %gms\n", manual ? "Manual" : "Auto-tuned",
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    compare_thread_pools(
+        opts, target,
+        [&](halide_do_par_for_t f) { output.set_custom_do_par_for(f); },
+        [&]() { out = output.realize(); });
+    if (out() != c_ref) {
+      printf("Mismatch: %d != %d\n", out(), c_ref);
+      return false;
+    }
 
     return true;
   }
 
+  // Hand-written schedule: the sum is split into chunks summed in parallel,
+  // each of which is summed as `lanes` interleaved partial sums so the
+  // inner loop is a vector add. On GPUs the chunks are blocks and the
+  // partial sums threads. The partial results are added up serially.
+  void schedule_manual(const Target &t) {
+    const bool gpu = t.has_gpu_feature();
+    const int chunk = gpu ? 2048 : 8192;
+    const int lanes = gpu ? 32 : t.natural_vector_size<int>();
+    RVar rxo, rxi, rxio, rxii;
+    Var u, v;
+    Func chunks = output.update().split(r.x, rxo, rxi, chunk).rfactor(rxo, u);
+    Func partial =
+        chunks.update().split(rxi, rxio, rxii, lanes).rfactor(rxii, v);
+    chunks.compute_root();
+    partial.compute_at(chunks, u);
+    if (gpu) {
+      chunks.gpu_blocks(u);
+      chunks.update().gpu_blocks(u);
+      partial.gpu_threads(v);
+      partial.update().gpu_threads(v);
+    } else {
+      chunks.parallel(u);
+      chunks.update().parallel(u);
+      partial.vectorize(v, lanes);
+      partial.update().vectorize(v, lanes);
+    }
+  }
+
 private:
   Var x;
   Target target;
+  RDom r;
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
 
   // Initialize with random data
@@ -72,9 +114,12 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (bool manual : schedule_modes(opts)) {
+    PipelineClass pipe(input);
+    if (!pipe.test_performance(opts, manual)) {
+      printf("Scheduling failed\n");
+      break;
+    }
   }
 
   return 0;
@@ -2,30 +2,50 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 
 #define WIDTH 1024
 #define HEIGHT 1024
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
-  Func dx, dy, sx, sy, sxy, gx, gy, gxy, interm, lambda, lambda1, lambda2;
-  float threshold = 200.0f;
+  Func output{"output"};
+  Func dx{"dx"}, dy{"dy"}, sx{"sx"}, sy{"sy"}, sxy{"sxy"};
+  Func gx{"gx"}, gy{"gy"}, gxy{"gxy"}, interm{"interm"};
+  Func lambda{"lambda"}, lambda1{"lambda1"}, lambda2{"lambda2"};
+  // Read at every call, so changing it needs no recompilation
+  Param<float> threshold = tunable("threshold", 200.0f);
   const int norm = 16;
   Buffer<int> input;
-  Buffer<int> maskg;
-  Buffer<int> masksx;
-  Buffer<int> masksy;
+  MaskParam<int> maskg;
+  MaskParam<int> masksx;
+  MaskParam<int> masksy;
+  Boundary boundary;
+  Footprint footprint;
 
   PipelineClass(Buffer<int> in, Buffer<int> mskg, Buffer<int> msksx,
-                Buffer<int> msksy)
-      : input(in), maskg(mskg), masksx(msksx), masksy(msksy) {
+                Buffer<int> msksy, Boundary boundary)
+      : input(in), maskg("maskg", mskg), masksx("masksx", msksx),
+        masksy("masksy", msksy), boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input, boundary);
+    footprint = (mask_footprint(masksx.buffer()) |
+                 mask_footprint(masksy.buffer())) +
+                mask_footprint(maskg.buffer());
 
     // compute x- and y-derivative
     dx(x, y) = Dx(gray)(x, y);
@@ -49,40 +69,77 @@ public:
     output(x, y) = Halide::select(lambda(x, y) > threshold, 1, 0);
   }
 
-  bool test_performance() {
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
     // Auto schedule the pipeline
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input);
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<int> out = output_buffer<int>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input, maskg.buffer(), masksx.buffer(),
+                           masksy.buffer(), Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
-
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<int> out(input.width(), input.height());
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
     // Exclude the H2D copying time
-    maskg.copy_to_device(target);
-    masksx.copy_to_device(target);
-    masksy.copy_to_device(target);
+    copy_to_device(maskg.buffer(), target);
+    copy_to_device(masksx.buffer(), target);
+    copy_to_device(masksy.buffer(), target);
 
-    double best_auto = benchmark(10, 3, [&]() {
-      input.copy_to_device(target);
-      p.realize(out);
+    auto run = [&]() {
+      copy_to_device(input, target);
+      runner.realize({out});
       out.copy_to_host(); // include D2H copying time
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    if (opts.param_sweep) {
+      int i = 0;
+      CacheBench sweep = run_cache_benchmark(opts, [&]() {
+        i++;
+        vary_params(i);
+        interior.vary_params(i);
+        run();
+      });
+      report_param_sweep(bench, sweep);
+    }
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
 
-    return true;
+    return time_ms;
+  }
+
+  // Move the threshold off its default by step `i`, back at 0
+  void vary_params(int i) { threshold.set(200.0f + 10.0f * (i % 8)); }
+
+  // Hand-written schedule: the 3x3 smoothing of three products reads the
+  // gradients at every tap, so they are computed once within each output
+  // tile, per tile or per row as params.level says, instead of inlined. The
+  // smoothed products go in the same tiles.
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output).producer(dx).producer(dy);
+    s.finish();
   }
 
 private:
@@ -92,7 +149,7 @@ private:
     using Halide::_;
     Func blur;
     Func out;
-    RDom dom(maskg); // a reduction domain of 3x3
+    RDom dom = maskg.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * maskg(dom.x, dom.y);
     blur(x, y) += conv;
     out(x, y) = blur(x, y) / norm;
@@ -102,7 +159,7 @@ private:
     using Halide::_;
     Func sobelY;
     Func outy;
-    RDom dom(masksy); // a reduction domain of 3x3
+    RDom dom = masksy.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * masksy(dom.x, dom.y);
     sobelY(x, y) += conv;
     outy(x, y) = sobelY(x, y) / 6;
@@ -112,7 +169,7 @@ private:
     using Halide::_;
     Func sobelX;
     Func outx;
-    RDom dom(masksx); // a reduction domain of 3x3
+    RDom dom = masksx.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * masksx(dom.x, dom.y);
     sobelX(x, y) += conv;
     outx(x, y) = sobelX(x, y) / 6;
@@ -121,6 +178,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -132,14 +191,6 @@ int main(int argc, char **argv) {
   const int coef_sx[size_x][size_y] = {{-1, 0, 1}, {-1, 0, 1}, {-1, 0, 1}};
   const int coef_sy[size_x][size_y] = {{-1, -1, -1}, {0, 0, 0}, {1, 1, 1}};
 
-  // Initialization with random image
-  Buffer<int> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<int> maskg(size_x, size_y);
   Buffer<int> masksx(size_x, size_y);
   Buffer<int> masksy(size_x, size_y);
@@ -160,9 +211,13 @@ int main(int argc, char **argv) {
   }
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, maskg, masksx, masksy);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<int> input = app_input<int>(opts, kind, width, height);
+    run_app_modes(opts, "ShiTomasiFeature", input, [&]() {
+      return std::make_shared<PipelineClass>(input, maskg, masksx, masksy,
+                                             input_boundary(opts));
+    });
   }
   return 0;
 }
@@ -2,27 +2,47 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "client_bench.h"
+#include "frame_stream.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
 
 #define WIDTH 384
 #define HEIGHT 256
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
-  Func dx, dy, dxn, dyn, outs;
-  float norm = 4.0f;
-  Buffer<float> input;
-  Buffer<int> masksx;
-  Buffer<int> masksy;
-
-  PipelineClass(Buffer<float> in, Buffer<int> msksx, Buffer<int> msksy)
-      : input(in), masksx(msksx), masksy(msksy) {
+  Func output{"output"};
+  Func dx{"dx"}, dy{"dy"}, dxn{"dxn"}, dyn{"dyn"}, outs{"outs"};
+  // Read at every call, so changing it needs no recompilation
+  Param<float> norm = tunable("norm", 4.0f);
+  BufferParam<float> input;
+  MaskParam<int> masksx;
+  MaskParam<int> masksy;
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<float> in, Buffer<int> msksx, Buffer<int> msksy,
+                Boundary boundary)
+      : input("input", in), masksx("masksx", msksx), masksy("masksy", msksy),
+        boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input.param(), boundary);
+    footprint =
+        mask_footprint(masksx.buffer()) | mask_footprint(masksy.buffer());
 
     dx(x, y) = Dx(gray)(x, y);
     dy(x, y) = Dy(gray)(x, y);
@@ -35,36 +55,74 @@ public:
     output(x, y) = Halide::select(outs(x, y) < 0.0f, 0.0f, outs(x, y));
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input.buffer());
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<float> out = output_buffer<float>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input.buffer(), masksx.buffer(), masksy.buffer(),
+                           Boundary::None);
+    if (mode.manual) {
+      schedule_manual(target, mode.params);
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    // Auto schedule the pipeline
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input.width(), input.height());
-
-    masksx.copy_to_device(target);
-    masksy.copy_to_device(target);
-    double best_auto = benchmark(10, 3, [&]() {
-      input.copy_to_device(target);
-      p.realize(out);
+    copy_to_device(masksx.buffer(), target);
+    copy_to_device(masksy.buffer(), target);
+    auto run = [&]() {
+      copy_to_device(input.buffer(), target);
+      runner.realize({out});
       out.copy_to_host();
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    if (opts.param_sweep) {
+      int i = 0;
+      CacheBench sweep = run_cache_benchmark(opts, [&]() {
+        i++;
+        vary_params(i);
+        interior.vary_params(i);
+        run();
+      });
+      report_param_sweep(bench, sweep);
+    }
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+    stream_frames<float, float>(opts, target, runner,
+                                {&input, &interior.input});
+    run_clients(opts, target, runner, {out});
+
+    return time_ms;
+  }
+
+  // Move the normalization off its default by step `i`, back at 0
+  void vary_params(int i) { norm.set(4.0f + 0.5f * (i % 8)); }
 
-    return true;
+  // Hand-written schedule: both gradients and the magnitude are computed
+  // per output tile; the gradients go in the same tiles through finish()
+  void schedule_manual(const Target &t, const ScheduleParams &params) {
+    ManualSchedule s(t, params);
+    s.output(output).producer(outs, ComputeLevel::Tile);
+    s.finish();
   }
 
 private:
@@ -74,7 +132,7 @@ private:
     using Halide::_;
     Func sobelY;
     Func outy;
-    RDom dom(masksy); // a reduction domain of 3x3
+    RDom dom = masksy.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * masksy(dom.x, dom.y);
     sobelY(x, y) += conv;
     outy(x, y) = sobelY(x, y) / 6;
@@ -84,7 +142,7 @@ private:
     using Halide::_;
     Func sobelX;
     Func outx;
-    RDom dom(masksx); // a reduction domain of 3x3
+    RDom dom = masksx.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * masksx(dom.x, dom.y);
     sobelX(x, y) += conv;
     outx(x, y) = sobelX(x, y) / 6;
@@ -93,6 +151,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -103,14 +163,6 @@ int main(int argc, char **argv) {
 
   const int coef_sy[size_x][size_y] = {{-1, -2, -1}, {0, 0, 0}, {1, 2, 1}};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<int> masksx(size_x, size_y);
   Buffer<int> masksy(size_x, size_y);
   for (int y = 0; y < masksx.height(); y++) {
@@ -125,9 +177,13 @@ int main(int argc, char **argv) {
   }
 
   printf("Running pipeline on GPU:\n");
-  PipelineClass pipe(input, masksx, masksy);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(opts, "Sobel", input, [&]() {
+      return std::make_shared<PipelineClass>(input, masksx, masksy,
+                                             input_boundary(opts));
+    });
   }
   return 0;
 }
@@ -0,0 +1,72 @@
+#include "Halide.h"
+#include "app_options.h"
+#include "app_target.h"
+#include "bench_harness.h"
+#include "halide_benchmark.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include <iostream>
+#include <limits>
+
+#define HEIGHT 2048
+
+using namespace Halide;
+using namespace Halide::Tools;
+using namespace HalideApps;
+
+// Times a separable 5x5 box filter on Buffer<int> images around the
+// power-of-two width 4096, with packed rows and with rows padded to an odd
+// number of cache lines. Packed 4096-wide rows are 16 KiB apart, so the five
+// rows read by the vertical pass land in the same cache sets.
+// Median time in ms
+double time_box(const AppOptions &opts, const Target &target, int width) {
+  Buffer<int> input = padded_buffer<int>(width, HEIGHT, opts.pad);
+  for (int y = 0; y < input.height(); y++) {
+    for (int x = 0; x < input.width(); x++) {
+      input(x, y) = rand() & 0xfff;
+    }
+  }
+
+  Var x, y;
+  RDom r(-2, 5);
+  Func clamped = BoundaryConditions::repeat_edge(input);
+  Func blur_y, sum, output;
+  blur_y(x, y) = 0;
+  blur_y(x, y) += clamped(x, y + r);
+  sum(x, y) = 0;
+  sum(x, y) += blur_y(x + r, y);
+  output(x, y) = sum(x, y) / 25;
+
+  Buffer<int> out = padded_buffer<int>(width, HEIGHT, opts.pad);
+  PipelineRunner runner(opts, target, {output}, buffer_rect(out));
+  runner.compile();
+
+  return run_cache_benchmark(opts, [&]() {
+           copy_to_device(input, target);
+           runner.realize({out});
+           out.copy_to_host();
+           out.device_sync();
+         })
+      .median_ms();
+}
+
+int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
+  Target target = app_target(opts);
+  const std::vector<int> widths = {4095, 4096, 4097};
+
+  printf("Running 5x5 box filter on Wx%d int images...\n", HEIGHT);
+  printf("| width | pitch | packed (ms) | padded (ms) |\n");
+  printf("|:----- | -----:| -----------:| -----------:|\n");
+  for (int width : widths) {
+    AppOptions packed = opts, padded = opts;
+    packed.pad = false;
+    padded.pad = true;
+    double packed_ms = time_box(packed, target, width);
+    double padded_ms = time_box(padded, target, width);
+    printf("| %5d | %5d | %11.4f | %11.4f |\n", width,
+           padded_pitch(width, sizeof(int)), packed_ms, padded_ms);
+  }
+  return 0;
+}
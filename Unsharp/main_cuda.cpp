@@ -2,25 +2,51 @@
 #include <limits>
 
 #include "Halide.h"
+#include "app_modes.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "fft_convolution.h"
+#include "frame_stream.h"
 #include "halide_benchmark.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "manual_schedule.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
+#include "spin_pool.h"
 
 #define WIDTH 512
 #define HEIGHT 512
 
 using namespace Halide;
 using namespace Halide::Tools;
+using namespace HalideApps;
 
 class PipelineClass {
 public:
-  Func output;
-  Func gaus, sharp, ratio;
-  const int norm = 16;
-  Buffer<float> input;
-  Buffer<int> mask;
-
-  PipelineClass(Buffer<float> in, Buffer<int> mask) : input(in), mask(mask) {
+  Func output{"output"};
+  Func gaus{"gaus"}, sharp{"sharp"}, ratio{"ratio"};
+  // The mask weights and their sum, which the blur is normalized by (16 for
+  // the 3x3 binomial mask); read at every call, so changing them needs no
+  // recompilation. The FFT path transforms the mask in every call too.
+  Param<int> norm;
+  BufferParam<float> input;
+  MaskParam<int> mask;
+  Buffer<int> default_mask;
+  bool use_fft;
+  Boundary boundary;
+  Footprint footprint;
+
+  PipelineClass(Buffer<float> in, Buffer<int> mask, bool use_fft,
+                Boundary boundary)
+      : norm(tunable("norm", weight(mask))), input("input", in),
+        mask("mask", mask), default_mask(mask), use_fft(use_fft),
+        boundary(boundary) {
     // Set a boundary condition
-    Func gray = BoundaryConditions::repeat_edge(input);
+    Func gray = guard_input(input.param(), boundary);
+    footprint = use_fft ? fft_footprint(mask) : mask_footprint(mask);
 
     gaus(x, y) = Gauss(gray)(x, y);
     sharp(x, y) = 2 * gray(x, y) - gaus(x, y);
@@ -28,44 +54,117 @@ public:
     output(x, y) = ratio(x, y) * gray(x, y);
   }
 
-  bool test_performance() {
-    target = get_host_target();
-    target.set_feature(Target::CUDA);
-    if (!target.has_gpu_feature()) {
-      return false;
+  double test_performance(const AppOptions &opts, const RunMode &mode) {
+    target = app_target(opts);
+
+    // Test the performance of the scheduled pipeline, into an output of
+    // just the region it produces: the interior for "valid" output.
+    Rect full = buffer_rect(input.buffer());
+    Rect region = output_region(full, boundary, footprint);
+    Buffer<float> out = output_buffer<float>(region, opts.pad);
+
+    // Schedule the pipeline, by hand or automatically. When split, an
+    // unguarded copy of it produces the interior.
+    PipelineRunner runner(opts, target, {output}, region);
+    runner.set_build_ms(mode.build_ms);
+    PipelineClass interior(input.buffer(), default_mask, use_fft,
+                           Boundary::None);
+    if (mode.manual) {
+      if (!schedule_manual(target, mode.params)) {
+        printf("No manual schedule for FFT convolution\n");
+        return -1;
+      }
+      interior.schedule_manual(target, mode.params);
+      runner.use_manual_schedule();
     }
+    if (mode.split) {
+      runner.split({interior.output}, interior_rect(full, footprint));
+    }
+    runner.compile();
 
-    // Enable debug info
-    // target.set_feature(Target::Profile);
-
-    output.set_estimate(x, 0, WIDTH).set_estimate(y, 0, HEIGHT);
-    Pipeline p(output);
-    p.auto_schedule(target);
-    output.compile_jit(target);
-
-    // Test the performance of the scheduled pipeline.
-    Buffer<float> out(input.width(), input.height());
-
-    mask.copy_to_device(target);
-    double best_auto = benchmark(10, 3, [&]() {
-      input.copy_to_device(target);
-      p.realize(out);
+    copy_to_device(mask.buffer(), target);
+    auto run = [&]() {
+      copy_to_device(input.buffer(), target);
+      runner.realize({out});
       out.copy_to_host();
       out.device_sync();
-    });
-    printf("Auto-tuned time: %gms\n", best_auto * 1e3);
+    };
+    CacheBench bench = run_cache_benchmark(opts, run);
+    printf("%s time (%s, %s): %gms\n", runner.schedule_label(),
+           boundary_name(boundary), runner.describe().c_str(),
+           bench.median_ms());
+    printf("  %s\n", bench.describe().c_str());
+    if (opts.param_sweep) {
+      int i = 0;
+      CacheBench sweep = run_cache_benchmark(opts, [&]() {
+        i++;
+        vary_params(i);
+        interior.vary_params(i);
+        run();
+      });
+      report_param_sweep(bench, sweep);
+    }
+    const double time_ms = bench.median_ms();
+    runner.write_profile(time_ms);
+    runner.report_roofline(time_ms);
+    runner.write_outputs({out}, time_ms);
+    stream_frames<float, float>(opts, target, runner,
+                                {&input, &interior.input});
+    compare_thread_pools(
+        opts, target,
+        [&](halide_do_par_for_t f) { runner.set_do_par_for(f); },
+        [&]() { runner.realize({out}); });
+
+    return time_ms;
+  }
+
+  // Replace the mask weights, keeping its shape
+  void set_weights(const Buffer<int> &w) {
+    mask.set(w);
+    norm.set(weight(w));
+  }
+
+  // Move the weights off their defaults by step `i`, back at 0: the centre
+  // tap gains i % 8
+  void vary_params(int i) {
+    Buffer<int> w = default_mask.copy();
+    const int cx = w.dim(0).min() + w.width() / 2;
+    const int cy = w.dim(1).min() + w.height() / 2;
+    w(cx, cy) += i % 8;
+    set_weights(w);
+  }
 
+  // Hand-written schedule: the blur is computed per output tile, and the
+  // pointwise sharpening inlined into the output. The FFT path has none.
+  bool schedule_manual(const Target &t, const ScheduleParams &params) {
+    if (use_fft) {
+      return false;
+    }
+    ManualSchedule s(t, params);
+    s.output(output);
+    s.finish();
     return true;
   }
 
 private:
   Var x, y;
   Target target;
+
+  static int weight(const Buffer<int> &w) {
+    int sum = 0;
+    w.for_each_value([&](int v) { sum += v; });
+    return sum;
+  }
+
   Func Gauss(Func f) {
     using Halide::_;
     Func blur;
     Func out;
-    RDom dom(mask); // a reduction domain of 3x3
+    if (use_fft) {
+      out(x, y) = fft_correlate(f, mask, "unsharp_fft")(x, y) / norm;
+      return out;
+    }
+    RDom dom = mask.domain(); // a reduction domain of 3x3
     Expr conv = f(x + dom.x, y + dom.y) * mask(dom.x, dom.y);
     blur(x, y) += conv;
     out(x, y) = blur(x, y) / norm;
@@ -74,6 +173,8 @@ private:
 };
 
 int main(int argc, char **argv) {
+  AppOptions opts = parse_app_options(argc, argv);
+  setup_benchmark_host(opts);
   const int width = WIDTH;
   const int height = HEIGHT;
   const int size_x = 3;
@@ -82,25 +183,35 @@ int main(int argc, char **argv) {
   // Gaussian mask
   const int coef[3][3] = {{1, 2, 1}, {2, 4, 2}, {1, 2, 1}};
 
-  // Initialize with random image
-  Buffer<float> input(width, height);
-  for (int y = 0; y < input.height(); y++) {
-    for (int x = 0; x < input.width(); x++) {
-      input(x, y) = rand() & 0xfff;
-    }
-  }
-
   Buffer<int> mask(size_x, size_y);
   for (int y = 0; y < mask.height(); y++) {
     for (int x = 0; x < mask.width(); x++) {
       mask(x, y) = coef[x][y];
     }
   }
+  if (opts.mask_size) {
+    // Box mask; the pipeline normalizes by its weight
+    mask = Buffer<int>(opts.mask_size, opts.mask_size);
+    mask.fill(1);
+  }
+
+  Target target = app_target(opts);
+  bool use_fft = use_fft_convolution(opts.conv, mask.width(), mask.height(),
+                                     target);
+  printf("%dx%d mask, %s convolution\n", mask.width(), mask.height(),
+         use_fft ? "FFT" : "direct");
 
   printf("Running Halide pipeline...\n");
-  PipelineClass pipe(input, mask);
-  if (!pipe.test_performance()) {
-    printf("Scheduling failed\n");
+  for (const std::string &kind : corpus_kinds(opts)) {
+    // The --input image, or a generated one of this kind
+    Buffer<float> input = app_input<float>(opts, kind, width, height);
+    run_app_modes(
+        opts, "Unsharp", input,
+        [&]() {
+          return std::make_shared<PipelineClass>(input, mask, use_fft,
+                                                 input_boundary(opts));
+        },
+        true, !use_fft);
   }
   return 0;
 }
@@ -0,0 +1,79 @@
+#ifndef COMMON_APP_MODES_H
+#define COMMON_APP_MODES_H
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "autotuner.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "manual_schedule.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// One configuration an app benchmarks its pipeline in
+struct RunMode {
+  // Realize the interior with an unguarded copy of the pipeline
+  bool split = false;
+  // Use the hand-written schedule, with `params`, instead of the
+  // autoscheduler
+  bool manual = false;
+  ScheduleParams params;
+  // Time it took to build the Func graph of the pipeline, in ms
+  double build_ms = 0;
+};
+
+// Benchmarks the pipeline of `app` on `input` in every mode --schedule and
+// --split ask for. `make` builds a fresh pipeline object, returned as a
+// std::shared_ptr, whose test_performance(opts, mode) runs one mode and
+// returns its median time in ms, or a negative value if the pipeline could
+// not be scheduled so. Under --tune the manual schedule is tuned first, on
+// candidates `make` builds too and timed with candidate_options(). Apps
+// whose outputs have no unguarded interior pass `splits` false, and those
+// without a manual schedule for this pipeline, such as the FFT path of a
+// convolution, pass `manual` false.
+template <typename Make>
+void run_app_modes(const AppOptions &opts, const std::string &app,
+                   const Buffer<> &input, Make make, bool splits = true,
+                   bool manual = true) {
+  for (bool use_manual : schedule_modes(opts)) {
+    if (use_manual && !manual) {
+      printf("No manual schedule for this pipeline\n");
+      continue;
+    }
+    for (bool split : splits ? split_modes(opts) : std::vector<bool>{false}) {
+      RunMode mode;
+      mode.split = split;
+      mode.manual = use_manual;
+      // Manual schedules run with tuned parameters under --tune
+      if (use_manual) {
+        const AppOptions tuning = candidate_options(opts);
+        auto measure = [&](const ScheduleParams &p) {
+          RunMode candidate = mode;
+          candidate.params = p;
+          return make()->test_performance(tuning, candidate);
+        };
+        mode.params = tune_schedule(
+            opts, tune_key(app, input, split, opts), measure);
+      }
+      const auto start = std::chrono::steady_clock::now();
+      auto pipe = make();
+      mode.build_ms = ms_since(start);
+      if (pipe->test_performance(opts, mode) < 0) {
+        printf("Scheduling failed\n");
+        break;
+      }
+    }
+  }
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef COMMON_APP_OPTIONS_H
+#define COMMON_APP_OPTIONS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace HalideApps {
+
+// Command-line options shared by all apps. Every flag has the form
+// --name=value; anything not listed here is rejected.
+struct AppOptions {
+  // Device the pipelines run on: "cuda" or "host" (CPU only)
+  std::string target = "cuda";
+  // Convolution path for linear masks: "auto", "direct" or "fft"
+  std::string conv = "auto";
+  // Square mask size replacing the app's built-in mask (0 keeps it)
+  int mask_size = 0;
+  // Loads outside the input: "repeat", "mirror", "constant", or "valid" to
+  // only produce pixels that need none
+  std::string boundary = "repeat";
+  // Interior/border split of stencil outputs: "off", "on" or "both"
+  std::string split = "off";
+  // Pad image rows to an odd number of cache lines
+  bool pad = true;
+  // Host allocations of intermediates: "off" (system malloc), "on" (reused
+  // size-class arena) or "thp" (arena backed by transparent huge pages)
+  std::string arena = "on";
+  // Reuse auto_schedule results from disk: "on", "off", or "refresh" to
+  // re-run the autoscheduler and report how its schedule changed
+  std::string schedule_cache = "off";
+  // Autoscheduler plugin: "Mullapudi2016", "Li2018" or "Adams2019"; empty
+  // uses Halide's default
+  std::string autoscheduler;
+  // "parallelism,last_level_cache_bytes,balance"; empty uses the defaults
+  std::string machine_params;
+  // Cache compiled pipelines as shared objects (CPU targets only)
+  bool object_cache = false;
+  // Schedules to benchmark: "auto", "manual" (hand-written) or "both"
+  std::string schedule = "auto";
+  // Search for the manual schedule parameters: "off", "random" or "genetic"
+  std::string tune = "off";
+  // Candidate schedules measured by a search
+  int tune_budget = 24;
+  // Compile with the Halide profiler and write a JSON report per run
+  bool profile = false;
+  // Count hardware events (cycles, instructions, cache, branch and TLB
+  // misses) around each realization with perf_event_open
+  bool perf = false;
+  // Place each run on a roofline of the measured bandwidth and peak FLOPS
+  bool roofline = false;
+  // Record the tasks of one realization per run as a Chrome trace
+  bool trace = false;
+  // Untimed calls before a benchmark samples
+  int warmup = 3;
+  // Sample until the 95% confidence interval of the mean time is within
+  // this many percent of it...
+  double bench_ci = 1;
+  // ...or for at most this many seconds
+  double bench_seconds = 2;
+  // Take exactly this many samples instead (0 samples to bench_ci)
+  int bench_samples = 0;
+  // CPUs to pin the process to, as a list like "0-3,8", or "off"
+  std::string pin = "off";
+  // Cache state of benchmarked calls: "hot" (inputs left in cache by the
+  // previous call), "cold" (caches evicted before each call) or "both"
+  std::string cache = "hot";
+  // Report the time of each step to the first frame: "off", "on", or
+  // "only" to also stop each benchmark after its first call
+  std::string startup = "off";
+  // Benchmark once more changing the runtime parameters before every call
+  bool param_sweep = false;
+  // Input images replacing the generated ones, in the order the app reads
+  // them
+  std::vector<std::string> inputs;
+  // Generated inputs to run on, one after the other: "all" or a list of
+  // kinds from input_corpus.h
+  std::string corpus = "noise";
+  // Elements per row of .raw inputs (0 uses the app's width)
+  int raw_width = 0;
+  // Directory to write the outputs of each run to; empty writes none
+  std::string output;
+  // Format of written outputs: "png", "pgm", "tiff" or "raw"
+  std::string output_format = "png";
+  // Frames to stream through each run after its benchmark (0 streams none)
+  int stream = 0;
+  // Realize several frames concurrently, each on a slice of the threads:
+  // "off", "auto" to pick the split from measured scaling, or "FxT" for F
+  // frames in flight on T threads each
+  std::string frame_parallel = "off";
+  // Realize from up to this many client threads at once (0 for none)
+  int clients = 0;
+  // Parallel loops of the clients: on the "shared" Halide thread pool, on
+  // "isolated" pools of their own, or "both"
+  std::string client_pool = "both";
+  // Compare the parallel loops of each run on the Halide thread pool with
+  // those on a pool of pinned, spinning workers that steal work
+  bool spin_pool = false;
+  // How long the workers of that pool spin for work before sleeping, in us
+  int spin_us = 50;
+  // Realize the output as one strip per NUMA node: "off", "on" for the
+  // nodes of the host, or N to split the CPUs into N simulated nodes
+  std::string numa = "off";
+};
+
+inline void app_options_error(const char *msg, const std::string &arg) {
+  fprintf(stderr, "%s: %s\n", msg, arg.c_str());
+  exit(1);
+}
+
+// "a,b,c" -> {"a", "b", "c"}
+inline std::vector<std::string> split_list(const std::string &list) {
+  std::vector<std::string> items;
+  size_t pos = 0;
+  while (pos <= list.size()) {
+    size_t end = std::min(list.find(',', pos), list.size());
+    items.push_back(list.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return items;
+}
+
+inline AppOptions parse_app_options(int argc, char **argv) {
+  AppOptions opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+    if (key == "--target") {
+      if (value != "cuda" && value != "host") {
+        app_options_error("Expected --target=cuda|host", arg);
+      }
+      opts.target = value;
+    } else if (key == "--conv") {
+      if (value != "auto" && value != "direct" && value != "fft") {
+        app_options_error("Expected --conv=auto|direct|fft", arg);
+      }
+      opts.conv = value;
+    } else if (key == "--mask-size") {
+      opts.mask_size = atoi(value.c_str());
+      if (opts.mask_size < 1) {
+        app_options_error("Expected a positive mask size", arg);
+      }
+    } else if (key == "--boundary") {
+      if (value != "repeat" && value != "mirror" && value != "constant" &&
+          value != "valid") {
+        app_options_error("Expected --boundary=repeat|mirror|constant|valid",
+                          arg);
+      }
+      opts.boundary = value;
+    } else if (key == "--split") {
+      if (value != "off" && value != "on" && value != "both") {
+        app_options_error("Expected --split=off|on|both", arg);
+      }
+      opts.split = value;
+    } else if (key == "--pad") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --pad=on|off", arg);
+      }
+      opts.pad = value == "on";
+    } else if (key == "--arena") {
+      if (value != "off" && value != "on" && value != "thp") {
+        app_options_error("Expected --arena=off|on|thp", arg);
+      }
+      opts.arena = value;
+    } else if (key == "--schedule-cache") {
+      if (value != "on" && value != "off" && value != "refresh") {
+        app_options_error("Expected --schedule-cache=on|off|refresh", arg);
+      }
+      opts.schedule_cache = value;
+    } else if (key == "--object-cache") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --object-cache=on|off", arg);
+      }
+      opts.object_cache = value == "on";
+    } else if (key == "--autoscheduler") {
+      if (value != "Mullapudi2016" && value != "Li2018" &&
+          value != "Adams2019") {
+        app_options_error("Expected --autoscheduler=Mullapudi2016|Li2018|"
+                          "Adams2019",
+                          arg);
+      }
+      opts.autoscheduler = value;
+    } else if (key == "--schedule") {
+      if (value != "auto" && value != "manual" && value != "both") {
+        app_options_error("Expected --schedule=auto|manual|both", arg);
+      }
+      opts.schedule = value;
+    } else if (key == "--tune") {
+      if (value != "off" && value != "random" && value != "genetic") {
+        app_options_error("Expected --tune=off|random|genetic", arg);
+      }
+      opts.tune = value;
+    } else if (key == "--tune-budget") {
+      opts.tune_budget = atoi(value.c_str());
+      if (opts.tune_budget < 1) {
+        app_options_error("Expected a positive tuning budget", arg);
+      }
+    } else if (key == "--profile") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --profile=on|off", arg);
+      }
+      opts.profile = value == "on";
+    } else if (key == "--perf") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --perf=on|off", arg);
+      }
+      opts.perf = value == "on";
+    } else if (key == "--roofline") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --roofline=on|off", arg);
+      }
+      opts.roofline = value == "on";
+    } else if (key == "--trace") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --trace=on|off", arg);
+      }
+      opts.trace = value == "on";
+    } else if (key == "--warmup") {
+      opts.warmup = atoi(value.c_str());
+      if (opts.warmup < 0) {
+        app_options_error("Expected a non-negative warmup count", arg);
+      }
+    } else if (key == "--bench-ci") {
+      opts.bench_ci = atof(value.c_str());
+      if (opts.bench_ci <= 0) {
+        app_options_error("Expected a positive percentage", arg);
+      }
+    } else if (key == "--bench-seconds") {
+      opts.bench_seconds = atof(value.c_str());
+      if (opts.bench_seconds <= 0) {
+        app_options_error("Expected a positive number of seconds", arg);
+      }
+    } else if (key == "--bench-samples") {
+      opts.bench_samples = atoi(value.c_str());
+      if (opts.bench_samples < 0) {
+        app_options_error("Expected a non-negative sample count", arg);
+      }
+    } else if (key == "--pin") {
+      opts.pin = value;
+    } else if (key == "--cache") {
+      if (value != "hot" && value != "cold" && value != "both") {
+        app_options_error("Expected --cache=hot|cold|both", arg);
+      }
+      opts.cache = value;
+    } else if (key == "--startup") {
+      if (value != "off" && value != "on" && value != "only") {
+        app_options_error("Expected --startup=off|on|only", arg);
+      }
+      opts.startup = value;
+    } else if (key == "--param-sweep") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --param-sweep=on|off", arg);
+      }
+      opts.param_sweep = value == "on";
+    } else if (key == "--input") {
+      opts.inputs = split_list(value);
+    } else if (key == "--corpus") {
+      opts.corpus = value;
+    } else if (key == "--raw-width") {
+      opts.raw_width = atoi(value.c_str());
+      if (opts.raw_width < 1) {
+        app_options_error("Expected a positive raw width", arg);
+      }
+    } else if (key == "--output") {
+      opts.output = value;
+    } else if (key == "--output-format") {
+      if (value != "png" && value != "pgm" && value != "tiff" &&
+          value != "raw") {
+        app_options_error("Expected --output-format=png|pgm|tiff|raw", arg);
+      }
+      opts.output_format = value;
+    } else if (key == "--stream") {
+      opts.stream = atoi(value.c_str());
+      if (opts.stream < 0) {
+        app_options_error("Expected a frame count", arg);
+      }
+    } else if (key == "--frame-parallel") {
+      int frames = 0, threads = 0;
+      char rest = 0;
+      if (value != "off" && value != "auto" &&
+          (sscanf(value.c_str(), "%dx%d%c", &frames, &threads, &rest) != 2 ||
+           frames < 1 || threads < 1)) {
+        app_options_error("Expected --frame-parallel=off|auto|FxT", arg);
+      }
+      opts.frame_parallel = value;
+    } else if (key == "--clients") {
+      opts.clients = atoi(value.c_str());
+      if (opts.clients < 0) {
+        app_options_error("Expected a client count", arg);
+      }
+    } else if (key == "--client-pool") {
+      if (value != "shared" && value != "isolated" && value != "both") {
+        app_options_error("Expected --client-pool=shared|isolated|both", arg);
+      }
+      opts.client_pool = value;
+    } else if (key == "--spin-pool") {
+      if (value != "on" && value != "off") {
+        app_options_error("Expected --spin-pool=on|off", arg);
+      }
+      opts.spin_pool = value == "on";
+    } else if (key == "--spin-us") {
+      opts.spin_us = atoi(value.c_str());
+      if (opts.spin_us < 0) {
+        app_options_error("Expected a spin time in us", arg);
+      }
+    } else if (key == "--numa") {
+      char *rest;
+      if (value != "off" && value != "on" &&
+          (strtol(value.c_str(), &rest, 10) < 1 || *rest)) {
+        app_options_error("Expected --numa=off|on|N", arg);
+      }
+      opts.numa = value;
+    } else if (key == "--machine-params") {
+      opts.machine_params = value;
+    } else {
+      app_options_error("Unknown option", arg);
+    }
+  }
+  // Only the host caches can be evicted, so cold calls on the GPU would
+  // time the same as hot ones
+  if (opts.cache != "hot" && opts.target != "host") {
+    app_options_error("Cold-cache benchmarks need --target=host",
+                      "--cache=" + opts.cache);
+  }
+  return opts;
+}
+
+} // namespace HalideApps
+
+#endif
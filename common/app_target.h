@@ -0,0 +1,35 @@
+#ifndef COMMON_APP_TARGET_H
+#define COMMON_APP_TARGET_H
+
+#include "Halide.h"
+#include "app_options.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// The host target, with CUDA enabled unless --target=host
+inline Target app_target(const AppOptions &opts) {
+  Target target = get_host_target();
+  if (opts.target == "cuda") {
+    target.set_feature(Target::CUDA);
+  }
+  return target;
+}
+
+// Copy `b` to the GPU of `target`. CPU targets read host memory directly.
+template <typename T> void copy_to_device(Buffer<T> &b, const Target &target) {
+  if (target.has_gpu_feature()) {
+    b.copy_to_device(target);
+  }
+}
+
+// Lanes an x extent should be a multiple of to run without tail iterations:
+// a warp on GPUs, the natural vector of `t` on CPUs
+inline int natural_lanes(const Target &target, const Type &t) {
+  return target.has_gpu_feature() ? 32 : target.natural_vector_size(t);
+}
+
+} // namespace HalideApps
+
+#endif
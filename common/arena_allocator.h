@@ -0,0 +1,134 @@
+#ifndef COMMON_ARENA_ALLOCATOR_H
+#define COMMON_ARENA_ALLOCATOR_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+namespace HalideApps {
+
+// Allocator counters, cumulative since the process started
+struct AllocStats {
+  uint64_t allocations = 0; // halide_malloc calls
+  uint64_t bytes = 0;       // bytes requested by them
+  uint64_t fresh = 0;       // calls that had to allocate new memory
+  uint64_t page_faults = 0; // minor and major faults of the whole process
+
+  AllocStats operator+(const AllocStats &o) const {
+    return {allocations + o.allocations, bytes + o.bytes, fresh + o.fresh,
+            page_faults + o.page_faults};
+  }
+
+  AllocStats operator-(const AllocStats &o) const {
+    return {allocations - o.allocations, bytes - o.bytes, fresh - o.fresh,
+            page_faults - o.page_faults};
+  }
+};
+
+// Allocator for the host memory of pipeline intermediates, installed into
+// JIT pipelines in place of halide_malloc/halide_free. With `reuse` off
+// every request goes to the system allocator and is only counted. With it
+// on, freed blocks are kept in free lists per size class and handed out
+// again, so after the first realization a pipeline neither calls malloc
+// nor touches fresh pages. Blocks of 2 MiB or more can be backed by
+// transparent huge pages.
+class ArenaAllocator {
+public:
+  static ArenaAllocator &instance() {
+    static ArenaAllocator arena;
+    return arena;
+  }
+
+  void configure(bool reuse, bool huge_pages) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->reuse = reuse;
+    this->huge_pages = huge_pages;
+  }
+
+  void *allocate(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    counters.allocations++;
+    counters.bytes += size;
+    const size_t cls = reuse ? size_class(size) : size;
+    void *p = nullptr;
+    if (reuse && !free_lists[cls].empty()) {
+      p = free_lists[cls].back();
+      free_lists[cls].pop_back();
+    } else {
+      counters.fresh++;
+      const size_t align = use_huge_pages(cls) ? huge_page_bytes : 128;
+      if (posix_memalign(&p, align, cls) != 0) {
+        return nullptr;
+      }
+      if (use_huge_pages(cls)) {
+        madvise(p, cls, MADV_HUGEPAGE);
+      }
+    }
+    live[p] = cls;
+    return p;
+  }
+
+  void release(void *p) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = live.find(p);
+    if (it == live.end()) {
+      return;
+    }
+    if (reuse) {
+      free_lists[it->second].push_back(p);
+    } else {
+      free(p);
+    }
+    live.erase(it);
+  }
+
+  AllocStats stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    AllocStats s = counters;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    s.page_faults = usage.ru_minflt + usage.ru_majflt;
+    return s;
+  }
+
+  // Hooks for Pipeline::set_custom_allocator
+  static void *halide_malloc(void *, size_t size) {
+    return instance().allocate(size);
+  }
+  static void halide_free(void *, void *p) { instance().release(p); }
+
+private:
+  static const size_t huge_page_bytes = 2 << 20;
+
+  std::mutex mutex;
+  bool reuse = false, huge_pages = false;
+  AllocStats counters;
+  std::map<size_t, std::vector<void *>> free_lists;
+  std::unordered_map<void *, size_t> live;
+
+  // Powers of two up to a huge page, whole huge pages above
+  static size_t size_class(size_t size) {
+    if (size >= huge_page_bytes) {
+      return (size + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+    }
+    size_t cls = 128;
+    while (cls < size) {
+      cls *= 2;
+    }
+    return cls;
+  }
+
+  bool use_huge_pages(size_t size) const {
+    return huge_pages && size >= huge_page_bytes;
+  }
+};
+
+} // namespace HalideApps
+
+#endif
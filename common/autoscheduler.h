@@ -0,0 +1,62 @@
+#ifndef COMMON_AUTOSCHEDULER_H
+#define COMMON_AUTOSCHEDULER_H
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+
+#include "Halide.h"
+#include "app_options.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Load the plugin that registers autoscheduler `name`, once per process.
+// The plugins ship with Halide as libautoschedule_<name>.so.
+inline void load_autoscheduler(const std::string &name) {
+  static std::set<std::string> loaded;
+  if (loaded.count(name)) {
+    return;
+  }
+  std::string lib = "autoschedule_";
+  for (char c : name) {
+    lib += tolower(c);
+  }
+  load_plugin(lib);
+  loaded.insert(name);
+}
+
+// --machine-params=parallelism,last_level_cache_bytes,balance, or the
+// autoscheduler's generic parameters when empty
+inline MachineParams machine_params(const AppOptions &opts) {
+  if (opts.machine_params.empty()) {
+    return MachineParams::generic();
+  }
+  int parallelism = 0;
+  long long cache = 0;
+  float balance = 0;
+  if (sscanf(opts.machine_params.c_str(), "%d,%lld,%f", &parallelism, &cache,
+             &balance) != 3) {
+    app_options_error("Expected --machine-params=parallelism,cache,balance",
+                      opts.machine_params);
+  }
+  return MachineParams(parallelism, cache, balance);
+}
+
+// Run autoscheduler --autoscheduler on `p`, Halide's default one if unset
+inline void run_autoscheduler(Pipeline &p, const Target &target,
+                              const AppOptions &opts) {
+  if (opts.autoscheduler.empty()) {
+    p.auto_schedule(target, machine_params(opts));
+  } else {
+    load_autoscheduler(opts.autoscheduler);
+    p.auto_schedule(opts.autoscheduler, target, machine_params(opts));
+  }
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,365 @@
+#ifndef COMMON_AUTOTUNER_H
+#define COMMON_AUTOTUNER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "app_target.h"
+#include "bench_harness.h"
+#include "manual_schedule.h"
+#include "schedule_cache.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Time in ms of a pipeline scheduled with the given parameters, or a
+// negative value if it could not be scheduled. Halide errors it throws rank
+// the candidate last.
+typedef std::function<double(const ScheduleParams &)> ScheduleMeasure;
+
+// Options for timing tuning candidates: a short fixed sample of hot calls,
+// which are not profiled, traced or counted, JIT compiled rather than added
+// to the object cache, and none of the side benchmarks and reports of a
+// full run, so that candidates write no files. Candidates are only ranked,
+// so they do without the adaptive benchmark.
+inline AppOptions candidate_options(const AppOptions &opts) {
+  AppOptions c = opts;
+  c.warmup = 1;
+  c.bench_samples = 5;
+  c.cache = "hot";
+  c.profile = false;
+  c.trace = false;
+  c.perf = false;
+  c.roofline = false;
+  c.startup = "off";
+  c.object_cache = false;
+  c.param_sweep = false;
+  c.output.clear();
+  c.stream = 0;
+  c.frame_parallel = "off";
+  c.clients = 0;
+  c.spin_pool = false;
+  c.numa = "off";
+  return c;
+}
+
+// What makes tuning results of one host invalid on another: CPU model,
+// core count, last-level cache size and the target
+inline std::string host_fingerprint(const Target &target) {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line, model = "unknown cpu";
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      model = line.substr(line.find(':') + 2);
+      break;
+    }
+  }
+  return model + ", " + std::to_string(sysconf(_SC_NPROCESSORS_ONLN)) +
+         " cores, " + std::to_string(sysconf(_SC_LEVEL3_CACHE_SIZE)) +
+         " bytes LLC, " + target.to_string();
+}
+
+// Identifies what a tuned schedule was tuned for besides the host: the app,
+// its input size and the options that change the pipeline
+inline std::string tune_key(const std::string &app, const Buffer<> &input,
+                            bool split, const AppOptions &opts) {
+  return app + "-" + std::to_string(input.width()) + "x" +
+         std::to_string(input.height()) + "-" + opts.boundary +
+         (split ? "-split" : "") +
+         (opts.mask_size ? "-mask" + std::to_string(opts.mask_size) : "");
+}
+
+inline const char *compute_level_name(ComputeLevel level) {
+  return level == ComputeLevel::Root   ? "root"
+         : level == ComputeLevel::Tile ? "tile"
+                                       : "row";
+}
+
+inline std::string describe_params(const ScheduleParams &p) {
+  char buf[128];
+  snprintf(buf, sizeof(buf), "%dx%d tiles, vector %d, %d tiles/task, %s",
+           p.tile_x, p.tile_y, p.vector, p.task_tiles,
+           compute_level_name(p.level));
+  return buf;
+}
+
+// Directory of tuned schedules, HL_TUNE_CACHE or ./tune_cache
+inline std::string tune_cache_dir() {
+  const char *dir = getenv("HL_TUNE_CACHE");
+  return dir ? dir : "tune_cache";
+}
+
+// Search for the ScheduleParams that run the fastest, timing each candidate
+// with a ScheduleMeasure. Each parameter takes one of a few values, its
+// genes; on GPUs only the compute level is searched, since the manual
+// schedules use fixed thread blocks there. Candidates are measured once.
+class Autotuner {
+public:
+  Autotuner(const Target &target, int budget) : budget(budget), rng(1) {
+    choices = {{16, 32, 64, 128, 256, 512}, // tile_x
+               {2, 4, 8, 16, 32, 64},       // tile_y
+               {0, 4, 8, 16},               // vector, 0 for natural
+               {1, 2, 4, 8},                // task_tiles
+               {0, 1, 2}};                  // level
+    if (target.has_gpu_feature()) {
+      ScheduleParams d;
+      choices[0] = {d.tile_x};
+      choices[1] = {d.tile_y};
+      choices[2] = {d.vector};
+      choices[3] = {d.task_tiles};
+    }
+  }
+
+  // Sample the space uniformly, starting from the default parameters
+  ScheduleParams random_search(const ScheduleMeasure &measure) {
+    measure_genes(default_genes(), measure);
+    for (int tries = 0; measured() < budget && tries < 100 * budget; tries++) {
+      measure_genes(random_genes(), measure);
+    }
+    return best_params();
+  }
+
+  // Evolve a population seeded with the default parameters: each generation
+  // keeps the best candidate and breeds the rest from tournament winners by
+  // uniform crossover and mutation
+  ScheduleParams genetic_search(const ScheduleMeasure &measure) {
+    const int population = std::max(2, std::min(8, budget / 3));
+    std::vector<Genes> pop = {default_genes()};
+    while ((int)pop.size() < population) {
+      pop.push_back(random_genes());
+    }
+    for (int generation = 0; measured() < budget; generation++) {
+      const int before = measured();
+      for (const Genes &g : pop) {
+        measure_genes(g, measure);
+      }
+      std::sort(pop.begin(), pop.end(), [&](const Genes &a, const Genes &b) {
+        return fitness(a) < fitness(b);
+      });
+      printf("Generation %d: best %.3fms (%s)\n", generation, fitness(pop[0]),
+             describe_params(params(pop[0])).c_str());
+      std::vector<Genes> next = {pop[0]};
+      while ((int)next.size() < population) {
+        next.push_back(mutate(crossover(tournament(pop), tournament(pop))));
+      }
+      pop = next;
+      if (measured() == before && generation > 0) {
+        break; // converged on already measured candidates
+      }
+    }
+    return best_params();
+  }
+
+  double best_ms() const {
+    return results.empty() ? -1 : fitness(best_genes());
+  }
+
+private:
+  typedef std::vector<int> Genes;
+
+  int budget;
+  std::mt19937 rng;
+  std::vector<std::vector<int>> choices;
+  std::map<Genes, double> results;
+
+  int measured() const { return (int)results.size(); }
+
+  ScheduleParams params(const Genes &g) const {
+    ScheduleParams p;
+    p.tile_x = choices[0][g[0]];
+    p.tile_y = choices[1][g[1]];
+    p.vector = choices[2][g[2]];
+    p.task_tiles = choices[3][g[3]];
+    p.level = (ComputeLevel)choices[4][g[4]];
+    return p;
+  }
+
+  Genes default_genes() const {
+    ScheduleParams d;
+    const int values[] = {d.tile_x, d.tile_y, d.vector, d.task_tiles,
+                          (int)d.level};
+    Genes g;
+    for (size_t i = 0; i < choices.size(); i++) {
+      auto it = std::find(choices[i].begin(), choices[i].end(), values[i]);
+      g.push_back(it == choices[i].end() ? 0 : it - choices[i].begin());
+    }
+    return g;
+  }
+
+  int random_gene(size_t i) {
+    return std::uniform_int_distribution<int>(0, choices[i].size() - 1)(rng);
+  }
+
+  Genes random_genes() {
+    Genes g;
+    for (size_t i = 0; i < choices.size(); i++) {
+      g.push_back(random_gene(i));
+    }
+    return g;
+  }
+
+  // Failed candidates rank last
+  double fitness(const Genes &g) const {
+    auto it = results.find(g);
+    return it == results.end() || it->second < 0 || it->second >= 1e30
+               ? 1e30
+               : it->second;
+  }
+
+  Genes best_genes() const {
+    Genes best = results.begin()->first;
+    for (auto &it : results) {
+      if (fitness(it.first) < fitness(best)) {
+        best = it.first;
+      }
+    }
+    return best;
+  }
+
+  ScheduleParams best_params() const {
+    return results.empty() ? ScheduleParams() : params(best_genes());
+  }
+
+  void measure_genes(const Genes &g, const ScheduleMeasure &measure) {
+    if (results.count(g) || measured() >= budget) {
+      return;
+    }
+    const ScheduleParams p = params(g);
+    printf("Candidate %d/%d: %s\n", measured() + 1, budget,
+           describe_params(p).c_str());
+    double ms = std::numeric_limits<double>::infinity();
+    try {
+      ms = measure(p);
+    } catch (const CompileError &e) {
+      printf("Candidate failed to compile: %s\n", e.what());
+    } catch (const RuntimeError &e) {
+      printf("Candidate failed to run: %s\n", e.what());
+    }
+    results[g] = ms;
+  }
+
+  const Genes &tournament(const std::vector<Genes> &pop) {
+    std::uniform_int_distribution<int> pick(0, pop.size() - 1);
+    const Genes &a = pop[pick(rng)], &b = pop[pick(rng)];
+    return fitness(a) <= fitness(b) ? a : b;
+  }
+
+  Genes crossover(const Genes &a, const Genes &b) {
+    Genes child = a;
+    for (size_t i = 0; i < child.size(); i++) {
+      if (rng() % 2) {
+        child[i] = b[i];
+      }
+    }
+    return child;
+  }
+
+  Genes mutate(Genes g) {
+    for (size_t i = 0; i < g.size(); i++) {
+      if (rng() % 5 == 0) {
+        g[i] = random_gene(i);
+      }
+    }
+    return g;
+  }
+};
+
+inline bool load_tuned_params(const std::string &path, ScheduleParams &p,
+                              double &ms) {
+  std::ifstream in(path);
+  std::string line, key, level;
+  bool has_ms = false, has_level = false;
+  while (std::getline(in, line)) {
+    std::istringstream s(line);
+    if (!(s >> key) || key == "#") {
+      continue;
+    } else if (key == "ms") {
+      has_ms = (bool)(s >> ms);
+    } else if (key == "tile") {
+      s >> p.tile_x >> p.tile_y;
+    } else if (key == "vector") {
+      s >> p.vector;
+    } else if (key == "task_tiles") {
+      s >> p.task_tiles;
+    } else if (key == "level" && s >> level) {
+      for (ComputeLevel l : {ComputeLevel::Root, ComputeLevel::Tile,
+                             ComputeLevel::Row}) {
+        if (level == compute_level_name(l)) {
+          p.level = l;
+          has_level = true;
+        }
+      }
+    }
+  }
+  return has_ms && has_level && p.tile_x > 0 && p.tile_y > 0 &&
+         p.task_tiles > 0;
+}
+
+inline void store_tuned_params(const std::string &path,
+                               const std::string &fingerprint,
+                               const ScheduleParams &p, double ms) {
+  if (!make_dirs(tune_cache_dir())) {
+    return;
+  }
+  std::ofstream out(path);
+  out << "# host " << fingerprint << "\n"
+      << "ms " << ms << "\n"
+      << "tile " << p.tile_x << " " << p.tile_y << "\n"
+      << "vector " << p.vector << "\n"
+      << "task_tiles " << p.task_tiles << "\n"
+      << "level " << compute_level_name(p.level) << "\n";
+}
+
+// Parameters for the manual schedule of the pipeline identified by `key`:
+// the defaults with --tune=off, otherwise the best ones found for this host,
+// searching with `measure` unless a previous search is cached
+inline ScheduleParams tune_schedule(const AppOptions &opts,
+                                    const std::string &key,
+                                    const ScheduleMeasure &measure) {
+  if (opts.tune == "off") {
+    return ScheduleParams();
+  }
+  const Target target = app_target(opts);
+  const std::string fingerprint = host_fingerprint(target);
+  const std::string path =
+      tune_cache_dir() + "/" + key + "-" + fnv1a(fingerprint) + ".tune";
+  ScheduleParams params;
+  double ms = 0;
+  if (load_tuned_params(path, params, ms)) {
+    printf("Tuned schedule from cache: %s (%.3fms when tuned)\n",
+           describe_params(params).c_str(), ms);
+    return params;
+  }
+
+  printf("Tuning %s with %s search over %d candidates\n", key.c_str(),
+         opts.tune.c_str(), opts.tune_budget);
+  Autotuner tuner(target, opts.tune_budget);
+  params = opts.tune == "genetic" ? tuner.genetic_search(measure)
+                                  : tuner.random_search(measure);
+  ms = tuner.best_ms();
+  if (ms < 0 || ms >= 1e30) {
+    printf("No candidate schedule ran, keeping the defaults\n");
+    return ScheduleParams();
+  }
+  printf("Tuned schedule: %s (%.3fms)\n", describe_params(params).c_str(), ms);
+  store_tuned_params(path, fingerprint, params, ms);
+  return params;
+}
+
+} // namespace HalideApps
+
+#endif
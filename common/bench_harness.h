@@ -0,0 +1,423 @@
+#ifndef COMMON_BENCH_HARNESS_H
+#define COMMON_BENCH_HARNESS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Halide.h"
+#include "app_options.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+inline double ms_since(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> d =
+      std::chrono::steady_clock::now() - start;
+  return d.count();
+}
+
+// Stores the time spent in its scope, in ms, into `ms` when it ends
+class ScopeTimer {
+public:
+  explicit ScopeTimer(double &ms)
+      : ms(ms), start(std::chrono::steady_clock::now()) {}
+  ~ScopeTimer() { ms = ms_since(start); }
+
+private:
+  double &ms;
+  std::chrono::steady_clock::time_point start;
+};
+
+// How run_benchmark samples a call
+struct BenchConfig {
+  // Untimed calls before the probe call that starts sampling
+  int warmup = 3;
+  // Stop once the 95% confidence interval of the mean is within this
+  // fraction of it
+  double target_ci = 0.01;
+  int min_samples = 10, max_samples = 500;
+  // Calls are batched into samples of at least this long, so that the clock
+  // resolution does not matter
+  double min_sample_ms = 1;
+  // Stop sampling after this long even if the interval is wider
+  double max_seconds = 10;
+  // Evict the caches before every call, outside the timed region; samples
+  // are then single calls
+  bool cold = false;
+};
+
+inline BenchConfig bench_config(const AppOptions &opts) {
+  BenchConfig c;
+  c.warmup = opts.warmup;
+  c.target_ci = opts.bench_ci / 100;
+  c.max_seconds = opts.bench_seconds;
+  if (opts.bench_samples > 0) {
+    c.min_samples = c.max_samples = opts.bench_samples;
+  }
+  return c;
+}
+
+// Evicts the data of previous calls from the caches of every core, by
+// streaming a buffer several times the size of the last-level cache through
+// a parallel Halide pipeline, so that it runs on the same thread pool as
+// the pipelines being timed and reaches their private caches too
+class CacheFlusher {
+public:
+  static CacheFlusher &instance() {
+    static CacheFlusher flusher;
+    return flusher;
+  }
+
+  void flush() { sweep.realize(dst, host); }
+
+private:
+  Target host = get_host_target();
+  Buffer<float> src, dst;
+  Func sweep{"cache_flush"};
+
+  CacheFlusher() {
+    const long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    const int n = (int)(std::max(4 * llc, 64L << 20) / sizeof(float) / 2);
+    src = Buffer<float>(n);
+    dst = Buffer<float>(n);
+    src.fill(0.0f);
+    Var x, xo, xi;
+    sweep(x) = src(x) + 1.0f;
+    sweep.split(x, xo, xi, 1 << 16)
+        .parallel(xo)
+        .vectorize(xi, host.natural_vector_size<float>());
+    sweep.compile_jit(host);
+  }
+};
+
+// Times in ms per call. Outliers lie outside the Tukey fences (1.5 times
+// the interquartile range beyond the quartiles) and are left out of the
+// mean and its confidence interval, but not the median.
+struct BenchResult {
+  double median_ms = 0, mean_ms = 0, ci_ms = 0, min_ms = 0, max_ms = 0;
+  int samples = 0, calls_per_sample = 1, outliers = 0;
+  bool converged = false;
+
+  std::string describe() const {
+    char buf[256];
+    if (samples == 1 && calls_per_sample == 1) {
+      snprintf(buf, sizeof(buf), "first call only, %.4gms", median_ms);
+      return buf;
+    }
+    snprintf(buf, sizeof(buf),
+             "median %.4gms, mean %.4gms +- %.2f%% (95%% CI%s), min %.4gms, "
+             "max %.4gms, %d samples of %d call%s, %d outlier%s",
+             median_ms, mean_ms, mean_ms > 0 ? 100 * ci_ms / mean_ms : 0,
+             converged ? "" : ", not converged", min_ms, max_ms, samples,
+             calls_per_sample, calls_per_sample == 1 ? "" : "s", outliers,
+             outliers == 1 ? "" : "s");
+    return buf;
+  }
+};
+
+// Two-sided 95% quantile of Student's t with `df` degrees of freedom, from
+// a table up to df = 30 and within 0.2% of it beyond
+inline double student_t95(int df) {
+  static const double table[] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  return df <= 30 ? table[std::max(df, 1) - 1] : 1.96 + 2.4 / df;
+}
+
+inline double percentile(const std::vector<double> &sorted, double p) {
+  const double pos = p * (sorted.size() - 1);
+  const size_t i = (size_t)pos;
+  const double f = pos - i;
+  return i + 1 < sorted.size() ? sorted[i] * (1 - f) + sorted[i + 1] * f
+                               : sorted[i];
+}
+
+inline void summarize(std::vector<double> samples, BenchResult &r) {
+  std::sort(samples.begin(), samples.end());
+  r.samples = (int)samples.size();
+  r.min_ms = samples.front();
+  r.max_ms = samples.back();
+  r.median_ms = percentile(samples, 0.5);
+  const double q1 = percentile(samples, 0.25), q3 = percentile(samples, 0.75);
+  const double lo = q1 - 1.5 * (q3 - q1), hi = q3 + 1.5 * (q3 - q1);
+  double sum = 0, sum2 = 0;
+  int n = 0;
+  for (double s : samples) {
+    if (s >= lo && s <= hi) {
+      sum += s;
+      sum2 += s * s;
+      n++;
+    }
+  }
+  r.outliers = r.samples - n;
+  r.mean_ms = sum / n;
+  const double var = n > 1 ? std::max(0.0, (sum2 - sum * sum / n) / (n - 1))
+                           : 0;
+  r.ci_ms = n > 1 ? student_t95(n - 1) * std::sqrt(var / n) : r.mean_ms;
+}
+
+// Time `op`: warm up, time one probe call to find how many calls make a
+// sample of min_sample_ms, then take samples until the confidence interval
+// of the mean is narrow enough, or the sample or time budget runs out. The
+// probe is the first sample, so with no warmup every call is counted.
+template <typename F>
+BenchResult run_benchmark(const BenchConfig &config, F op) {
+  typedef std::chrono::steady_clock Clock;
+  for (int i = 0; i < config.warmup; i++) {
+    op();
+  }
+  if (config.cold) {
+    CacheFlusher::instance().flush();
+  }
+  Clock::time_point probe = Clock::now();
+  op();
+  const double call_ms = ms_since(probe);
+
+  BenchResult r;
+  r.calls_per_sample =
+      config.cold ? 1
+                  : std::max(1, (int)std::ceil(config.min_sample_ms /
+                                               std::max(call_ms, 1e-6)));
+  std::vector<double> samples = {call_ms};
+  Clock::time_point start = probe;
+  while ((int)samples.size() < config.max_samples) {
+    if (config.cold) {
+      CacheFlusher::instance().flush();
+    }
+    Clock::time_point t = Clock::now();
+    for (int i = 0; i < r.calls_per_sample; i++) {
+      op();
+    }
+    samples.push_back(ms_since(t) / r.calls_per_sample);
+    if ((int)samples.size() < config.min_samples) {
+      continue;
+    }
+    summarize(samples, r);
+    r.converged = r.ci_ms <= config.target_ci * r.mean_ms;
+    if (r.converged || ms_since(start) > config.max_seconds * 1e3) {
+      break;
+    }
+  }
+  summarize(samples, r);
+  return r;
+}
+
+// Hot- and cold-cache results of a benchmark, as --cache asks
+struct CacheBench {
+  BenchResult hot, cold;
+  bool has_hot = false, has_cold = false;
+
+  // The headline time: hot when measured, else cold
+  double median_ms() const { return has_hot ? hot.median_ms : cold.median_ms; }
+
+  std::string describe() const {
+    std::string s;
+    if (has_hot) {
+      s += "hot:  " + hot.describe();
+    }
+    if (has_cold) {
+      char ratio[64] = "";
+      if (has_hot && hot.median_ms > 0) {
+        snprintf(ratio, sizeof(ratio), " (%.2fx hot)",
+                 cold.median_ms / hot.median_ms);
+      }
+      s += std::string(has_hot ? "\n  " : "") + "cold: " + cold.describe() +
+           ratio;
+    }
+    return s;
+  }
+};
+
+// With --startup=only, just the first call, hot
+template <typename F>
+CacheBench run_cache_benchmark(const AppOptions &opts, F op) {
+  CacheBench b;
+  if (opts.startup == "only") {
+    double ms = 0;
+    {
+      ScopeTimer timer(ms);
+      op();
+    }
+    summarize({ms}, b.hot);
+    b.has_hot = true;
+    return b;
+  }
+  BenchConfig config = bench_config(opts);
+  if (opts.cache != "cold") {
+    b.hot = run_benchmark(config, op);
+    b.has_hot = true;
+  }
+  if (opts.cache != "hot") {
+    config.cold = true;
+    b.cold = run_benchmark(config, op);
+    b.has_cold = true;
+  }
+  return b;
+}
+
+// "0-3,8" -> {0, 1, 2, 3, 8}; empty if malformed
+inline std::vector<int> parse_cpu_list(const std::string &list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    std::string item = list.substr(pos, end - pos);
+    size_t dash = item.find('-');
+    char *rest;
+    const int first = strtol(item.c_str(), &rest, 10);
+    const int last = dash == std::string::npos
+                         ? first
+                         : strtol(item.c_str() + dash + 1, &rest, 10);
+    if (item.empty() || *rest || first < 0 || last < first) {
+      return {};
+    }
+    for (int c = first; c <= last; c++) {
+      cpus.push_back(c);
+    }
+    pos = end == std::string::npos ? list.size() : end + 1;
+  }
+  return cpus;
+}
+
+// The CPUs the process may run on
+inline std::vector<int> allowed_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+      if (CPU_ISSET(c, &set)) {
+        cpus.push_back(c);
+      }
+    }
+  }
+  return cpus;
+}
+
+// Restrict the calling thread to `cpus`; false if that fails
+inline bool pin_current_thread(const std::vector<int> &cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c : cpus) {
+    if (c < CPU_SETSIZE) {
+      CPU_SET(c, &set);
+    }
+  }
+  return !cpus.empty() && sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+// Threads the process may use: HL_NUM_THREADS if set, which --pin sets to
+// the pinned CPUs, else the CPUs it may run on
+inline int available_threads() {
+  const char *env = getenv("HL_NUM_THREADS");
+  if (env && atoi(env) > 0) {
+    return atoi(env);
+  }
+  const int cpus = (int)allowed_cpus().size();
+  return cpus > 0 ? cpus
+                  : std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+inline std::string read_sysfs(const std::string &path) {
+  std::ifstream in(path);
+  std::string v;
+  std::getline(in, v);
+  return v;
+}
+
+// Create directory `path` and any missing parents, as mkdir -p does; print
+// why and return false if that fails
+inline bool make_dirs(const std::string &path) {
+  for (size_t end = path.find('/', 1);; end = path.find('/', end + 1)) {
+    const std::string dir = path.substr(0, end);
+    if (!dir.empty() && mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+      printf("Cannot create directory %s: %s\n", dir.c_str(),
+             strerror(errno));
+      return false;
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+  }
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    printf("Cannot create directory %s: %s\n", path.c_str(),
+           path.empty() ? "empty path" : "not a directory");
+    return false;
+  }
+  return true;
+}
+
+// Pin the process to the CPUs of --pin and report what makes timings on
+// this host vary: the frequency governor, turbo, and the clock of the first
+// CPU. Call at the start of main, before any pipeline starts the Halide
+// thread pool, so that its threads inherit the affinity; the pool is sized
+// to the pinned CPUs unless HL_NUM_THREADS says otherwise.
+inline void setup_benchmark_host(const AppOptions &opts) {
+  int first_cpu = 0;
+  std::string pinned = "not pinned";
+  if (opts.pin != "off") {
+    std::vector<int> cpus = parse_cpu_list(opts.pin);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int c : cpus) {
+      if (c < CPU_SETSIZE) {
+        CPU_SET(c, &set);
+      }
+    }
+    const bool valid =
+        !cpus.empty() &&
+        *std::max_element(cpus.begin(), cpus.end()) < CPU_SETSIZE;
+    if (!valid || sched_setaffinity(0, sizeof(set), &set) != 0) {
+      app_options_error("Cannot pin to CPUs", opts.pin);
+    }
+    setenv("HL_NUM_THREADS", std::to_string(cpus.size()).c_str(), 0);
+    first_cpu = cpus[0];
+    pinned = "pinned to CPUs " + opts.pin;
+  }
+
+  const std::string cpufreq = "/sys/devices/system/cpu/cpu" +
+                              std::to_string(first_cpu) + "/cpufreq/";
+  const std::string governor = read_sysfs(cpufreq + "scaling_governor");
+  const std::string no_turbo =
+      read_sysfs("/sys/devices/system/cpu/intel_pstate/no_turbo");
+  const std::string boost =
+      read_sysfs("/sys/devices/system/cpu/cpufreq/boost");
+  const std::string turbo = no_turbo == "1" || boost == "0"   ? "off"
+                            : no_turbo == "0" || boost == "1" ? "on"
+                                                              : "unknown";
+  const double cur_mhz =
+      atof(read_sysfs(cpufreq + "scaling_cur_freq").c_str()) / 1e3;
+  const double max_mhz =
+      atof(read_sysfs(cpufreq + "cpuinfo_max_freq").c_str()) / 1e3;
+  char clock[64] = "clock unknown";
+  if (cur_mhz > 0) {
+    snprintf(clock, sizeof(clock), "CPU %d at %.0f of %.0f MHz", first_cpu,
+             cur_mhz, max_mhz);
+  }
+  printf("Benchmark host: %s, governor %s, turbo %s, %s\n", pinned.c_str(),
+         governor.empty() ? "unknown" : governor.c_str(), turbo.c_str(),
+         clock);
+  if ((!governor.empty() && governor != "performance") || turbo == "on") {
+    printf("Warning: the CPU clock varies with load (set the performance "
+           "governor and disable turbo for stable timings)\n");
+  }
+}
+
+} // namespace HalideApps
+
+#endif
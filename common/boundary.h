@@ -0,0 +1,159 @@
+#ifndef COMMON_BOUNDARY_H
+#define COMMON_BOUNDARY_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "padded_buffer.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// How loads outside the input are answered
+enum class Boundary {
+  RepeatEdge, // clamp to the nearest edge pixel
+  Mirror,     // reflect about the edge pixel
+  Constant,   // zero outside the input
+  None,       // no guarding; the caller only reads inside the input
+};
+
+inline const char *boundary_name(Boundary b) {
+  switch (b) {
+  case Boundary::RepeatEdge:
+    return "repeat_edge";
+  case Boundary::Mirror:
+    return "mirror";
+  case Boundary::Constant:
+    return "constant";
+  default:
+    return "unguarded";
+  }
+}
+
+// `input` is a Buffer or an ImageParam
+template <typename Image>
+Func guard_input(const Image &input, Boundary boundary) {
+  switch (boundary) {
+  case Boundary::RepeatEdge:
+    return BoundaryConditions::repeat_edge(input);
+  case Boundary::Mirror:
+    return BoundaryConditions::mirror_interior(input);
+  case Boundary::Constant:
+    return BoundaryConditions::constant_exterior(input,
+                                                 cast(input.type(), 0));
+  default: {
+    Var x, y;
+    Func raw;
+    raw(x, y) = input(x, y);
+    return raw;
+  }
+  }
+}
+
+// Offsets, relative to an output pixel, of the input pixels it reads
+struct Footprint {
+  int min_x = 0, max_x = 0, min_y = 0, max_y = 0;
+
+  // Footprint of a stage applied to the output of another
+  Footprint operator+(const Footprint &o) const {
+    return {min_x + o.min_x, max_x + o.max_x, min_y + o.min_y, max_y + o.max_y};
+  }
+
+  // Footprint of two stages reading the same input
+  Footprint operator|(const Footprint &o) const {
+    return {std::min(min_x, o.min_x), std::max(max_x, o.max_x),
+            std::min(min_y, o.min_y), std::max(max_y, o.max_y)};
+  }
+};
+
+// Footprint of `f(x + dom.x, y + dom.y) * mask(dom.x, dom.y)` with RDom dom(mask)
+template <typename T> Footprint mask_footprint(const Buffer<T> &mask) {
+  Footprint fp;
+  fp.min_x = mask.dim(0).min();
+  fp.max_x = mask.dim(0).max();
+  fp.min_y = mask.dim(1).min();
+  fp.max_y = mask.dim(1).max();
+  // The apps also read the center pixel
+  return fp | Footprint();
+}
+
+struct Rect {
+  int x, y, width, height;
+
+  bool empty() const { return width <= 0 || height <= 0; }
+
+  bool operator==(const Rect &o) const {
+    return x == o.x && y == o.y && width == o.width && height == o.height;
+  }
+};
+
+template <typename T> Rect buffer_rect(const Buffer<T> &b) {
+  return {b.dim(0).min(), b.dim(1).min(), b.width(), b.height()};
+}
+
+// Output pixels of `r` whose whole footprint lies inside `r`
+inline Rect interior_rect(const Rect &r, const Footprint &fp) {
+  return {r.x - fp.min_x, r.y - fp.min_y, r.width - (fp.max_x - fp.min_x),
+          r.height - (fp.max_y - fp.min_y)};
+}
+
+// The strips of `r` around `interior`: full-width rows above and below,
+// interior-height columns left and right. Empty strips are dropped.
+inline std::vector<Rect> border_strips(const Rect &r, const Rect &interior) {
+  const int x1 = interior.x + interior.width;
+  const int y1 = interior.y + interior.height;
+  std::vector<Rect> strips = {
+      {r.x, r.y, r.width, interior.y - r.y},
+      {r.x, y1, r.width, r.y + r.height - y1},
+      {r.x, interior.y, interior.x - r.x, interior.height},
+      {x1, interior.y, r.x + r.width - x1, interior.height},
+  };
+  strips.erase(std::remove_if(strips.begin(), strips.end(),
+                              [](const Rect &s) { return s.empty(); }),
+               strips.end());
+  return strips;
+}
+
+// Region of `full` an app produces: unguarded pipelines ("valid" output)
+// only produce the pixels whose footprint stays inside the input.
+inline Rect output_region(const Rect &full, Boundary b, const Footprint &fp) {
+  return b == Boundary::None ? interior_rect(full, fp) : full;
+}
+
+// An output buffer over `region`, with padded_buffer() rows and its mins
+// at the region's origin, so that it holds just the pixels the app produces
+template <typename T> Buffer<T> output_buffer(const Rect &region, bool pad) {
+  Buffer<T> b = padded_buffer<T>(region.width, region.height, pad);
+  b.set_min(region.x, region.y);
+  return b;
+}
+
+inline Boundary input_boundary(const AppOptions &opts) {
+  if (opts.boundary == "mirror") {
+    return Boundary::Mirror;
+  } else if (opts.boundary == "constant") {
+    return Boundary::Constant;
+  } else if (opts.boundary == "valid") {
+    return Boundary::None;
+  }
+  return Boundary::RepeatEdge;
+}
+
+// Whether to run the pipeline guarded everywhere, split into interior and
+// border, or both for comparison. Valid-only output has no border to split.
+inline std::vector<bool> split_modes(const AppOptions &opts) {
+  if (opts.boundary == "valid" || opts.split == "off") {
+    return {false};
+  } else if (opts.split == "on") {
+    return {true};
+  }
+  return {false, true};
+}
+
+} // namespace HalideApps
+
+#endif
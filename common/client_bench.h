@@ -0,0 +1,86 @@
+#ifndef COMMON_CLIENT_BENCH_H
+#define COMMON_CLIENT_BENCH_H
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "frame_parallel.h"
+#include "pipeline_runner.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// With --clients=N, realize the pipelines from 1, 2, 4, ... N client threads
+// at once, each with its own copy of them and of `outs`, as a service
+// calling one compiled pipeline from its request threads does. Each count
+// runs for a second and reports the calls per second of all clients, the
+// latency of their calls and the context switches per call, which grow as
+// the clients contend for the one Halide thread pool ("shared"). "isolated"
+// gives each client a pool of its own, N / clients threads wide, instead.
+// CPU targets only, like run_frame_parallel().
+inline void run_clients(const AppOptions &opts, const Target &target,
+                        PipelineRunner &runner,
+                        const std::vector<Buffer<>> &outs) {
+  if (opts.clients == 0) {
+    return;
+  }
+  if (target.has_gpu_feature()) {
+    printf("Clients: CPU targets only\n");
+    return;
+  }
+  if (opts.profile || opts.trace) {
+    printf("Clients: not with --profile or --trace\n");
+    return;
+  }
+  const int n = available_threads();
+  const double seconds = std::min(1.0, opts.bench_seconds);
+  std::vector<std::vector<Buffer<>>> client_outs;
+  copy_outputs(outs, opts.clients, client_outs);
+  for (const char *name : {"shared", "isolated"}) {
+    const std::string pool = name;
+    if (opts.client_pool != "both" && opts.client_pool != pool) {
+      continue;
+    }
+    const bool isolated = pool == "isolated";
+    runner.make_copies(opts.clients,
+                       isolated ? TaskSlice::halide_do_par_for : nullptr);
+    double single_fps = 0;
+    for (int c = 1;; c = std::min(2 * c, opts.clients)) {
+      FrameSplit split;
+      split.frames = c;
+      split.threads = isolated ? std::max(1, n / c) : 0;
+      const FrameRun r = run_frames(runner, client_outs, split, seconds);
+      const size_t calls = r.latency_ms.size();
+      if (c == 1) {
+        single_fps = r.fps();
+      }
+      std::string where = pool + " pool";
+      if (isolated) {
+        where += "s of " + std::to_string(split.threads);
+      }
+      printf("Clients %d, %s: %.1f calls/s (%.2fx 1 client)", c,
+             where.c_str(), r.fps(),
+             single_fps > 0 ? r.fps() / single_fps : 0);
+      if (calls > 0) {
+        printf(", latency p50 %.3gms, p99 %.3gms, max %.3gms, %.1f context "
+               "switches per call",
+               percentile(r.latency_ms, 0.5), percentile(r.latency_ms, 0.99),
+               r.latency_ms.back(), double(r.context_switches) / calls);
+      }
+      printf("\n");
+      if (c == opts.clients) {
+        break;
+      }
+    }
+    runner.drop_copies();
+  }
+}
+
+} // namespace HalideApps
+
+#endif
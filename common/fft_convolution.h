@@ -0,0 +1,379 @@
+#ifndef COMMON_FFT_CONVOLUTION_H
+#define COMMON_FFT_CONVOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "halide_benchmark.h"
+#include "runtime_params.h"
+
+// Frequency-domain evaluation of the linear masks the apps apply with
+//   out(x, y) = sum_{i,j} f(x + i, y + j) * mask(i, j)
+// The image is cut into blocks, each block is zero-padded to an n x n tile
+// (n a power of two), multiplied with the mask spectrum and the overlapping
+// block results are added back together (overlap-add).
+namespace HalideApps {
+
+using namespace Halide;
+
+// Mask sizes for which the FFT path is timed against the direct one
+inline std::vector<int> fft_crossover_sizes() {
+  return {7, 11, 15, 19, 23, 27, 31, 39, 47, 55, 63};
+}
+
+// Tile size for a mask: a power of two at least four times the larger mask
+// side so that most of each tile carries useful output.
+inline int fft_tile_size(int mask_w, int mask_h) {
+  int n = 32;
+  while (n < 4 * std::max(mask_w, mask_h)) {
+    n *= 2;
+  }
+  return n;
+}
+
+// Twiddle factors exp(-2 pi i k / n) for k in [0, n / 2), (re, im) in dim 1
+inline Buffer<float> fft_twiddles(int n) {
+  Buffer<float> tw(n / 2, 2);
+  for (int k = 0; k < n / 2; k++) {
+    double a = -2.0 * M_PI * k / n;
+    tw(k, 0) = (float)cos(a);
+    tw(k, 1) = (float)sin(a);
+  }
+  return tw;
+}
+
+inline Expr bit_reverse(Expr i, int bits) {
+  Expr r = 0;
+  for (int b = 0; b < bits; b++) {
+    r = r | (((i >> b) & 1) << (bits - 1 - b));
+  }
+  return r;
+}
+
+// Radix-2 decimation-in-time FFT of length n along args[dim] of a complex
+// Func holding (re, im) tuples. The inverse transform is unnormalized.
+inline Func fft_1d(Func in, const std::vector<Var> &args, int dim, int n,
+                   bool inverse, const Buffer<float> &tw,
+                   const std::string &name) {
+  int bits = 0;
+  while ((1 << bits) < n) {
+    bits++;
+  }
+  Var k = args[dim];
+
+  std::vector<Expr> perm(args.begin(), args.end());
+  perm[dim] = clamp(bit_reverse(k, bits), 0, n - 1);
+  Func stage(name + "_perm");
+  stage(args) = Tuple(in(perm)[0], in(perm)[1]);
+
+  for (int s = 0; s < bits; s++) {
+    const int h = 1 << s;
+    Expr j = k % (2 * h);
+    Expr lo = clamp(select(j < h, k, k - h), 0, n - h - 1);
+    Expr t = (j % h) * (n / (2 * h));
+    Expr wr = tw(t, 0);
+    Expr wi = inverse ? -tw(t, 1) : tw(t, 1);
+
+    std::vector<Expr> a(args.begin(), args.end()), b = a;
+    a[dim] = lo;
+    b[dim] = lo + h;
+    Expr ar = stage(a)[0], ai = stage(a)[1];
+    Expr br = stage(b)[0], bi = stage(b)[1];
+    Expr tr = br * wr - bi * wi;
+    Expr ti = br * wi + bi * wr;
+
+    Func next(name + "_s" + std::to_string(s));
+    next(args) = Tuple(select(j < h, ar + tr, ar - tr),
+                       select(j < h, ai + ti, ai - ti));
+    stage = next;
+  }
+  return stage;
+}
+
+// Forward 2D FFT of a real n x n tile over (args[0], args[1]). Two rows are
+// packed into one complex row transform and only the bins [0, n / 2] of the
+// Hermitian half-spectrum are produced along args[0].
+inline Func fft2d_r2c(Func tile, const std::vector<Var> &args, int n,
+                      const Buffer<float> &tw, const std::string &name) {
+  Var u = args[0], v = args[1];
+  const int h = n / 2;
+
+  std::vector<Expr> top(args.begin(), args.end()), bottom = top;
+  bottom[1] = v + h;
+  Func packed(name + "_pack");
+  packed(args) = Tuple(Expr(tile(top)), Expr(tile(bottom)));
+  Func rows = fft_1d(packed, args, 0, n, false, tw, name + "_rows");
+
+  // Split the packed spectrum Z = X + iY using X(k) = (Z(k) + conj(Z(-k))) / 2
+  // and Y(k) = (Z(k) - conj(Z(-k))) / 2i.
+  std::vector<Expr> p(args.begin(), args.end()), q = p;
+  p[1] = v % h;
+  q[0] = (n - u) % n;
+  q[1] = v % h;
+  Expr zr = rows(p)[0], zi = rows(p)[1];
+  Expr cr = rows(q)[0], ci = rows(q)[1];
+  Func half(name + "_half");
+  half(args) = Tuple(select(v < h, (zr + cr) * 0.5f, (zi + ci) * 0.5f),
+                     select(v < h, (zi - ci) * 0.5f, (cr - zr) * 0.5f));
+
+  return fft_1d(half, args, 1, n, false, tw, name + "_cols");
+}
+
+// Inverse of fft2d_r2c: takes the half-spectrum (bins [0, n / 2] along
+// args[0]) and returns the real n x n tile, normalized.
+inline Func fft2d_c2r(Func spec, const std::vector<Var> &args, int n,
+                      const Buffer<float> &tw, const std::string &name) {
+  Var u = args[0], v = args[1];
+  const int h = n / 2;
+  Func cols = fft_1d(spec, args, 1, n, true, tw, name + "_cols");
+
+  // Rebuild the full row spectra from Hermitian symmetry and pack two real
+  // rows A + iB into each complex inverse transform.
+  Expr mirrored = u > h;
+  std::vector<Expr> a(args.begin(), args.end());
+  a[0] = clamp(select(mirrored, n - u, u), 0, h);
+  std::vector<Expr> b = a;
+  b[1] = v + h;
+  Expr ar = cols(a)[0], ai = select(mirrored, -cols(a)[1], cols(a)[1]);
+  Expr br = cols(b)[0], bi = select(mirrored, -cols(b)[1], cols(b)[1]);
+  Func packed(name + "_pack");
+  packed(args) = Tuple(ar - bi, ai + br);
+  Func rows = fft_1d(packed, args, 0, n, true, tw, name + "_rows");
+
+  std::vector<Expr> r(args.begin(), args.end());
+  r[1] = v % h;
+  Func out(name);
+  out(args) = select(v < h, rows(r)[0], rows(r)[1]) * (1.0f / (n * n));
+  return out;
+}
+
+// The buffer a mask has, or was made with, which gives its shape
+template <typename T> const Buffer<T> &mask_buffer(const Buffer<T> &mask) {
+  return mask;
+}
+template <typename T>
+const Buffer<T> &mask_buffer(const MaskParam<T> &mask) {
+  return mask.buffer();
+}
+
+// Applies `mask` to `f` like the RDom form above, through the frequency domain.
+// The result has the type the direct form would produce. `mask` is a Buffer
+// or a MaskParam; the spectrum of the mask is computed in every realization,
+// so the weights of a MaskParam can change between calls.
+template <typename Mask>
+Func fft_correlate(Func f, const Mask &mask,
+                   const std::string &name = "fft_conv") {
+  const auto &shape = mask_buffer(mask);
+  const int mw = shape.width(), mh = shape.height();
+  const int mx = shape.dim(0).min(), my = shape.dim(1).min();
+  const int n = fft_tile_size(mw, mh);
+  // Block strides; a block plus the mask reach fills one tile.
+  const int sx = n - mw + 1, sy = n - mh + 1;
+  Buffer<float> tw = fft_twiddles(n);
+  Var u("u"), v("v"), bx("bx"), by("by"), x("x"), y("y");
+
+  // Zero-padded input blocks
+  Func block(name + "_block");
+  Expr fx = bx * sx + min(u, sx - 1) + mx;
+  Expr fy = by * sy + min(v, sy - 1) + my;
+  block(u, v, bx, by) =
+      select(u < sx && v < sy, cast<float>(f(fx, fy)), 0.0f);
+
+  // Mask reversed and zero-padded so that circular convolution of a block
+  // with it yields the correlation.
+  Func kernel(name + "_kernel");
+  Expr ku = (n - u) % n, kv = (n - v) % n;
+  kernel(u, v) = select(ku < mw && kv < mh,
+                        cast<float>(mask(clamp(ku, 0, mw - 1) + mx,
+                                         clamp(kv, 0, mh - 1) + my)),
+                        0.0f);
+
+  Func kspec = fft2d_r2c(kernel, {u, v}, n, tw, name + "_kfft");
+  Func bspec = fft2d_r2c(block, {u, v, bx, by}, n, tw, name + "_bfft");
+  Func prod(name + "_prod");
+  Expr ar = bspec(u, v, bx, by)[0], ai = bspec(u, v, bx, by)[1];
+  Expr br = kspec(u, v)[0], bi = kspec(u, v)[1];
+  prod(u, v, bx, by) = Tuple(ar * br - ai * bi, ar * bi + ai * br);
+  Func blocks = fft2d_c2r(prod, {u, v, bx, by}, n, tw, name + "_ifft");
+
+  // Overlap-add: a pixel receives its own block and, within the mask reach
+  // of the next block boundary, the neighbours to the right and below whose
+  // results wrap around to the end of their tiles.
+  Expr b0x = x / sx, b0y = y / sy;
+  Expr u0 = x - b0x * sx, v0 = y - b0y * sy;
+  Expr u1 = u0 - sx + n, v1 = v0 - sy + n;
+  Expr next_x = u0 >= sx - mw + 1, next_y = v0 >= sy - mh + 1;
+  Expr sum = blocks(u0, v0, b0x, b0y) +
+             select(next_x, blocks(u1, v0, b0x + 1, b0y), 0.0f) +
+             select(next_y, blocks(u0, v1, b0x, b0y + 1), 0.0f) +
+             select(next_x && next_y, blocks(u1, v1, b0x + 1, b0y + 1), 0.0f);
+
+  Type t = (cast(f.output_types()[0], 0) * cast(shape.type(), 0)).type();
+  Func out(name);
+  out(x, y) = t.is_float() ? cast(t, sum) : cast(t, round(sum));
+  return out;
+}
+
+// Input reach of fft_correlate. Blocks are read whole, so a pixel depends on
+// inputs up to one block before it and two blocks after it.
+template <typename T> Footprint fft_footprint(const Buffer<T> &mask) {
+  const int n = fft_tile_size(mask.width(), mask.height());
+  const int sx = n - mask.width() + 1, sy = n - mask.height() + 1;
+  Footprint fp;
+  fp.min_x = mask.dim(0).min() - (sx - 1);
+  fp.max_x = mask.dim(0).min() + 2 * sx - 1;
+  fp.min_y = mask.dim(1).min() - (sy - 1);
+  fp.max_y = mask.dim(1).min() + 2 * sy - 1;
+  return fp;
+}
+
+// The direct RDom form, as used by the apps
+template <typename T>
+Func direct_correlate(Func f, const Buffer<T> &mask,
+                      const std::string &name = "direct_conv") {
+  Var x("x"), y("y");
+  Func out(name);
+  RDom dom(mask);
+  out(x, y) += f(x + dom.x, y + dom.y) * mask(dom.x, dom.y);
+  return out;
+}
+
+struct ConvTiming {
+  int mask_size;
+  double direct_ms;
+  double fft_ms;
+};
+
+inline double time_correlation(Func conv, Buffer<float> &out,
+                               const Target &target) {
+  conv.set_estimate(conv.args()[0], 0, out.width())
+      .set_estimate(conv.args()[1], 0, out.height());
+  Pipeline p(conv);
+  p.auto_schedule(target);
+  p.compile_jit(target);
+  return run_benchmark(BenchConfig(), [&]() {
+           p.realize(out);
+           out.device_sync();
+         })
+      .median_ms;
+}
+
+// Times both paths on a width x height image for each square mask size
+inline std::vector<ConvTiming>
+measure_conv_timings(const Target &target, const std::vector<int> &sizes,
+                     int width = 1024, int height = 1024) {
+  Buffer<float> input(width, height);
+  for (int y = 0; y < input.height(); y++) {
+    for (int x = 0; x < input.width(); x++) {
+      input(x, y) = rand() & 0xfff;
+    }
+  }
+  Func gray = BoundaryConditions::repeat_edge(input);
+  Buffer<float> out(width, height);
+
+  std::vector<ConvTiming> timings;
+  for (int m : sizes) {
+    Buffer<float> mask(m, m);
+    mask.fill(1.0f / (m * m));
+    ConvTiming t;
+    t.mask_size = m;
+    t.direct_ms = time_correlation(direct_correlate(gray, mask), out, target);
+    t.fft_ms = time_correlation(fft_correlate(gray, mask), out, target);
+    timings.push_back(t);
+  }
+  return timings;
+}
+
+// Smallest measured mask size from which the FFT path stays faster, or 0 if
+// it never wins.
+inline int crossover_from_timings(const std::vector<ConvTiming> &timings) {
+  int crossover = 0;
+  for (auto it = timings.rbegin(); it != timings.rend(); ++it) {
+    if (it->fft_ms >= it->direct_ms) {
+      break;
+    }
+    crossover = it->mask_size;
+  }
+  return crossover;
+}
+
+inline std::string fft_crossover_cache_path() {
+  const char *path = getenv("HL_FFT_CROSSOVER_CACHE");
+  return path ? path : "fft_crossover.txt";
+}
+
+// Cached crossovers are stored as "<target> <size>" lines, one per target
+inline bool load_fft_crossover(const Target &target, int *crossover) {
+  std::ifstream in(fft_crossover_cache_path());
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string key;
+    int size;
+    if (fields >> key >> size && key == target.to_string()) {
+      *crossover = size;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline void store_fft_crossover(const Target &target, int crossover) {
+  std::vector<std::string> kept;
+  {
+    std::ifstream in(fft_crossover_cache_path());
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.compare(0, line.find(' '), target.to_string()) != 0) {
+        kept.push_back(line);
+      }
+    }
+  }
+  std::ofstream out(fft_crossover_cache_path());
+  for (const std::string &line : kept) {
+    out << line << "\n";
+  }
+  out << target.to_string() << " " << crossover << "\n";
+}
+
+// Crossover mask size for `target`, measured on first use on this host
+inline int fft_crossover(const Target &target) {
+  int crossover;
+  if (load_fft_crossover(target, &crossover)) {
+    return crossover;
+  }
+  printf("Measuring FFT convolution crossover for %s...\n",
+         target.to_string().c_str());
+  crossover = crossover_from_timings(
+      measure_conv_timings(target, fft_crossover_sizes()));
+  store_fft_crossover(target, crossover);
+  return crossover;
+}
+
+// Resolves a --conv mode for a mask. "auto" only measures the crossover for
+// masks large enough to be candidates at all.
+inline bool use_fft_convolution(const std::string &mode, int mask_w,
+                                int mask_h, const Target &target) {
+  if (mode != "auto") {
+    return mode == "fft";
+  }
+  const int m = std::max(mask_w, mask_h);
+  if (m < fft_crossover_sizes().front()) {
+    return false;
+  }
+  const int crossover = fft_crossover(target);
+  return crossover > 0 && m >= crossover;
+}
+
+} // namespace HalideApps
+
+#endif
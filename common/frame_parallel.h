@@ -0,0 +1,343 @@
+#ifndef COMMON_FRAME_PARALLEL_H
+#define COMMON_FRAME_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "Halide.h"
+#include "HalideRuntime.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "pipeline_runner.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// A bounded share of the CPUs for the parallel loops of one frame: the
+// thread that realizes the frame plus `threads - 1` helpers of its own.
+// Pipelines whose loops go through TaskSlice::halide_do_par_for run them on
+// the slice the calling thread entered, instead of on the Halide thread pool
+// every pipeline of the process shares. Loops nested inside a task, and
+// loops of threads outside any slice, run inline. The helpers run on any
+// CPU of the process, or only on `cpus` when those are given.
+class TaskSlice {
+public:
+  explicit TaskSlice(int threads,
+                     const std::vector<int> &cpus = std::vector<int>()) {
+    for (int i = 1; i < threads; i++) {
+      helpers.emplace_back([this, cpus]() {
+        if (!cpus.empty()) {
+          pin_current_thread(cpus);
+        }
+        help();
+      });
+    }
+  }
+
+  ~TaskSlice() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : helpers) {
+      t.join();
+    }
+  }
+
+  TaskSlice(const TaskSlice &) = delete;
+  TaskSlice &operator=(const TaskSlice &) = delete;
+
+  int threads() const { return (int)helpers.size() + 1; }
+
+  // Run the parallel loops of the calling thread on this slice
+  void enter() { current() = this; }
+  static void leave() { current() = nullptr; }
+
+  // Hook for Pipeline::set_custom_do_par_for
+  static int halide_do_par_for(void *user_context, halide_task_t f, int min,
+                               int size, uint8_t *closure) {
+    TaskSlice *slice = current();
+    if (!slice || slice->busy || slice->helpers.empty() || size < 2) {
+      for (int i = min; i < min + size; i++) {
+        const int result = f(user_context, i, closure);
+        if (result != 0) {
+          return result;
+        }
+      }
+      return 0;
+    }
+    return slice->run(user_context, f, min, size, closure);
+  }
+
+private:
+  std::vector<std::thread> helpers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  bool stopping = false;
+  // Whether the owning thread is in a loop; only it reads and writes this
+  bool busy = false;
+  // The current loop, set under the mutex before `generation` moves on
+  uint64_t generation = 0;
+  halide_task_t task = nullptr;
+  void *context = nullptr;
+  uint8_t *closure = nullptr;
+  int end = 0;
+  std::atomic<int> next{0}, result{0};
+  // Helpers still in the current loop
+  int working = 0;
+
+  static TaskSlice *&current() {
+    static thread_local TaskSlice *slice = nullptr;
+    return slice;
+  }
+
+  int run(void *user_context, halide_task_t f, int min, int size,
+          uint8_t *c) {
+    busy = true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = f;
+      context = user_context;
+      closure = c;
+      end = min + size;
+      next = min;
+      result = 0;
+      working = (int)helpers.size();
+      generation++;
+    }
+    wake.notify_all();
+    work();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [&]() { return working == 0; });
+    }
+    busy = false;
+    return result;
+  }
+
+  // Take tasks of the current loop until none are left
+  void work() {
+    for (int i = next++; i < end; i = next++) {
+      const int r = task(context, i, closure);
+      if (r != 0) {
+        result = r;
+      }
+    }
+  }
+
+  void help() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wake.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+      lock.unlock();
+      work();
+      lock.lock();
+      if (--working == 0) {
+        done.notify_one();
+      }
+    }
+  }
+};
+
+// Frames in flight, and threads realizing each
+struct FrameSplit {
+  int frames = 1, threads = 1;
+
+  std::string describe() const {
+    return std::to_string(frames) + " frame" + (frames == 1 ? "" : "s") +
+           " x " + std::to_string(threads) + " thread" +
+           (threads == 1 ? "" : "s");
+  }
+};
+
+// Frames realized in a timed window, with the time each took and the
+// context switches of the process meanwhile
+struct FrameRun {
+  double seconds = 0;
+  std::vector<double> latency_ms;
+  long context_switches = 0;
+
+  double fps() const { return seconds > 0 ? latency_ms.size() / seconds : 0; }
+
+  std::string describe() const {
+    if (latency_ms.empty()) {
+      return "no frames";
+    }
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%.1f fps (p50 %.3gms, p99 %.3gms per frame)",
+             fps(), percentile(latency_ms, 0.5), percentile(latency_ms, 0.99));
+    return buf;
+  }
+};
+
+inline long context_switches() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+// Realize frames with `split` for `seconds`: one worker per frame in flight,
+// each realizing its copy of the pipelines into its own outputs with a slice
+// of the threads, or, with 0 threads, on the pool the copies use. Every
+// worker realizes one untimed frame first.
+inline FrameRun run_frames(PipelineRunner &runner,
+                           std::vector<std::vector<Buffer<>>> &outs,
+                           const FrameSplit &split, double seconds) {
+  typedef std::chrono::steady_clock Clock;
+  std::vector<std::unique_ptr<TaskSlice>> slices;
+  auto enter = [&](int w) {
+    if (slices[w]) {
+      slices[w]->enter();
+    }
+  };
+  for (int w = 0; w < split.frames; w++) {
+    slices.emplace_back(split.threads > 0 ? new TaskSlice(split.threads)
+                                          : nullptr);
+    enter(w);
+    runner.realize_copy(w, outs[w]);
+    TaskSlice::leave();
+  }
+  std::vector<std::vector<double>> latency(split.frames);
+  std::vector<std::thread> workers;
+  const long switches = context_switches();
+  const Clock::time_point start = Clock::now();
+  const Clock::time_point deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(seconds));
+  for (int w = 0; w < split.frames; w++) {
+    workers.emplace_back([&, w]() {
+      enter(w);
+      while (Clock::now() < deadline) {
+        const Clock::time_point t = Clock::now();
+        runner.realize_copy(w, outs[w]);
+        latency[w].push_back(ms_since(t));
+      }
+      TaskSlice::leave();
+    });
+  }
+  for (std::thread &t : workers) {
+    t.join();
+  }
+  FrameRun r;
+  r.seconds = ms_since(start) / 1e3;
+  r.context_switches = context_switches() - switches;
+  for (const std::vector<double> &l : latency) {
+    r.latency_ms.insert(r.latency_ms.end(), l.begin(), l.end());
+  }
+  std::sort(r.latency_ms.begin(), r.latency_ms.end());
+  return r;
+}
+
+// Extend `copies` to `n` private copies of `outs`
+inline void copy_outputs(const std::vector<Buffer<>> &outs, int n,
+                         std::vector<std::vector<Buffer<>>> &copies) {
+  while ((int)copies.size() < n) {
+    std::vector<Buffer<>> copy;
+    for (const Buffer<> &b : outs) {
+      copy.push_back(b.copy());
+    }
+    copies.push_back(copy);
+  }
+}
+
+// With --frame-parallel, compare realizing one frame at a time on all the
+// threads with realizing several independent frames concurrently, each on
+// its own slice of them, into copies of `outs`. A frame that takes t(T) ms
+// on T of N threads lets N / T frames in flight finish (N / T) / t(T) frames
+// per ms; "auto" measures t(T) for powers of two and picks the best split.
+// CPU targets only: GPU kernels do not run on the thread pool.
+inline void run_frame_parallel(const AppOptions &opts, const Target &target,
+                               PipelineRunner &runner,
+                               const std::vector<Buffer<>> &outs) {
+  if (opts.frame_parallel == "off") {
+    return;
+  }
+  if (target.has_gpu_feature()) {
+    printf("Frame parallel: CPU targets only\n");
+    return;
+  }
+  if (opts.profile || opts.trace) {
+    printf("Frame parallel: not with --profile or --trace\n");
+    return;
+  }
+  const int n = available_threads();
+  std::vector<std::vector<Buffer<>>> frame_outs;
+  auto provide = [&](int frames) {
+    runner.make_copies(frames, TaskSlice::halide_do_par_for);
+    copy_outputs(outs, frames, frame_outs);
+  };
+  // Many splits to measure, so each gets a shorter budget
+  BenchConfig config = bench_config(opts);
+  config.max_seconds = std::min(config.max_seconds, 2.0);
+  auto frame_ms = [&](int threads) {
+    TaskSlice slice(threads);
+    slice.enter();
+    BenchResult r = run_benchmark(
+        config, [&]() { runner.realize_copy(0, frame_outs[0]); });
+    TaskSlice::leave();
+    return r.median_ms;
+  };
+
+  FrameSplit chosen;
+  provide(1);
+  if (opts.frame_parallel == "auto") {
+    std::string scaling;
+    double best_fps = 0;
+    for (int t = 1;; t = std::min(2 * t, n)) {
+      const double ms = frame_ms(t);
+      const double fps = ms > 0 ? (n / t) * 1e3 / ms : 0;
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%s%d: %.3gms", scaling.empty() ? "" : ", ",
+               t, ms);
+      scaling += buf;
+      if (fps > best_fps) {
+        best_fps = fps;
+        chosen.frames = n / t;
+        chosen.threads = t;
+      }
+      if (t == n) {
+        break;
+      }
+    }
+    printf("Frame scaling (threads: ms per frame): %s; predicted best %s "
+           "at %.1f fps\n",
+           scaling.c_str(), chosen.describe().c_str(), best_fps);
+  } else {
+    sscanf(opts.frame_parallel.c_str(), "%dx%d", &chosen.frames,
+           &chosen.threads);
+  }
+
+  const double seconds = std::min(1.0, opts.bench_seconds);
+  provide(chosen.frames);
+  FrameSplit whole;
+  whole.threads = n;
+  const FrameRun one = run_frames(runner, frame_outs, whole, seconds);
+  const FrameRun many = run_frames(runner, frame_outs, chosen, seconds);
+  runner.drop_copies();
+  printf("Frame parallel: %s of %d: %s against %s one frame at a time on "
+         "all threads, %.2fx\n",
+         chosen.describe().c_str(), n, many.describe().c_str(),
+         one.describe().c_str(), one.fps() > 0 ? many.fps() / one.fps() : 0);
+}
+
+} // namespace HalideApps
+
+#endif
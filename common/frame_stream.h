@@ -0,0 +1,212 @@
+#ifndef COMMON_FRAME_STREAM_H
+#define COMMON_FRAME_STREAM_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "image_io.h"
+#include "input_corpus.h"
+#include "padded_buffer.h"
+#include "pipeline_runner.h"
+#include "runtime_params.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Frame `i` of a stream, of the size of the app's input: the --input files
+// in turn, or else generated frames of the kind of the current input, each
+// from its own seed
+template <typename T>
+Buffer<T> stream_frame(const AppOptions &opts, int i, int width, int height,
+                       int max_value = 0xfff) {
+  if (opts.inputs.empty()) {
+    const std::string &kind = input_stats().kind;
+    return generate_input<T>(kind.empty() ? "noise" : kind, width, height,
+                             max_value, opts.pad, i);
+  }
+  const std::string &path = opts.inputs[i % opts.inputs.size()];
+  Buffer<T> b = is_raw_path(path)
+                    ? map_raw<T>(path, opts.raw_width ? opts.raw_width : width)
+                    : decode_image<T>(path, opts.pad, max_value);
+  if (b.width() != width || b.height() != height) {
+    app_options_error("Frames must all have the size of the first", path);
+  }
+  return b;
+}
+
+// Per-frame times of a stream, in ms
+struct StreamResult {
+  double seconds = 0;
+  std::vector<double> latency_ms, decode_ms, compute_ms, encode_ms;
+
+  std::string describe() const {
+    const size_t n = latency_ms.size();
+    if (n == 0) {
+      return "no frames";
+    }
+    std::vector<double> sorted = latency_ms;
+    std::sort(sorted.begin(), sorted.end());
+    auto mean = [](const std::vector<double> &v) {
+      double sum = 0;
+      for (double d : v) {
+        sum += d;
+      }
+      return sum / v.size();
+    };
+    char buf[320];
+    snprintf(buf, sizeof(buf),
+             "%zu frames in %.2fs, %.1f fps sustained; latency p50 %.3gms, "
+             "p90 %.3gms, p99 %.3gms, max %.3gms; mean decode %.3gms, "
+             "compute %.3gms, encode %.3gms",
+             n, seconds, n / seconds, percentile(sorted, 0.5),
+             percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back(),
+             mean(decode_ms), mean(compute_ms), mean(encode_ms));
+    return buf;
+  }
+};
+
+// Runs `frames` frames through three stages on their own threads: `decode`
+// on a reader thread, `compute` on the calling thread, which owns the Halide
+// pipelines, and `encode` on a writer thread. The stages hand frames over
+// through three slots, each with its output buffer, so while one frame is
+// computed the next is decoded and the previous encoded, and no output is
+// allocated after the first frame. A frame's latency runs from the start of
+// its decode to the end of its encode.
+template <typename T>
+StreamResult run_stream(int frames, std::function<Buffer<T>(int)> decode,
+                        std::function<void(const Buffer<T> &, Buffer<> &)>
+                            compute,
+                        std::function<void(int, const Buffer<> &)> encode,
+                        const std::vector<Buffer<>> &outputs) {
+  typedef std::chrono::steady_clock Clock;
+  enum State { Free, Decoded, Computed };
+  struct Slot {
+    State state = Free;
+    Buffer<T> input;
+    Buffer<> output;
+    Clock::time_point start;
+  };
+  std::vector<Slot> slots(outputs.size());
+  for (size_t s = 0; s < slots.size(); s++) {
+    slots[s].output = outputs[s];
+  }
+  std::mutex mutex;
+  std::condition_variable changed;
+  auto wait_for = [&](Slot &slot, State state) {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&]() { return slot.state == state; });
+  };
+  auto hand_over = [&](Slot &slot, State state) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.state = state;
+    }
+    changed.notify_all();
+  };
+
+  StreamResult r;
+  r.latency_ms.resize(frames);
+  r.decode_ms.resize(frames);
+  r.compute_ms.resize(frames);
+  r.encode_ms.resize(frames);
+  const Clock::time_point start = Clock::now();
+  std::thread reader([&]() {
+    for (int i = 0; i < frames; i++) {
+      Slot &slot = slots[i % slots.size()];
+      wait_for(slot, Free);
+      slot.start = Clock::now();
+      slot.input = decode(i);
+      r.decode_ms[i] = ms_since(slot.start);
+      hand_over(slot, Decoded);
+    }
+  });
+  std::thread writer([&]() {
+    for (int i = 0; i < frames; i++) {
+      Slot &slot = slots[i % slots.size()];
+      wait_for(slot, Computed);
+      Clock::time_point t = Clock::now();
+      encode(i, slot.output);
+      r.encode_ms[i] = ms_since(t);
+      r.latency_ms[i] = ms_since(slot.start);
+      hand_over(slot, Free);
+    }
+  });
+  for (int i = 0; i < frames; i++) {
+    Slot &slot = slots[i % slots.size()];
+    wait_for(slot, Decoded);
+    Clock::time_point t = Clock::now();
+    compute(slot.input, slot.output);
+    r.compute_ms[i] = ms_since(t);
+    hand_over(slot, Computed);
+  }
+  reader.join();
+  writer.join();
+  r.seconds = ms_since(start) / 1e3;
+  return r;
+}
+
+// With --stream=N, stream N frames through `runner`, whose pipelines read
+// their input through `inputs`, into three reused output buffers of type
+// Out over the region it produces, and print the sustained rate and
+// latencies. Frames are encoded to --output when it is set. The inputs are
+// bound to their first buffer again afterwards.
+template <typename T, typename Out>
+void stream_frames(const AppOptions &opts, const Target &target,
+                   PipelineRunner &runner,
+                   const std::vector<BufferParam<T> *> &inputs,
+                   int max_value = 0xfff) {
+  if (opts.stream == 0) {
+    return;
+  }
+  const Buffer<T> first = inputs[0]->buffer();
+  const int width = first.width(), height = first.height();
+  std::vector<Buffer<>> outs;
+  for (int s = 0; s < 3; s++) {
+    outs.push_back(output_buffer<Out>(runner.output_rect(), opts.pad));
+  }
+  StreamResult r = run_stream<T>(
+      opts.stream,
+      [&](int i) {
+        return stream_frame<T>(opts, i, width, height, max_value);
+      },
+      [&](const Buffer<T> &frame, Buffer<> &out) {
+        for (BufferParam<T> *in : inputs) {
+          in->set(frame);
+        }
+        copy_to_device(inputs[0]->buffer(), target);
+        runner.realize({out});
+        out.copy_to_host();
+        out.device_sync();
+      },
+      [&](int i, const Buffer<> &out) {
+        if (opts.output.empty()) {
+          return;
+        }
+        char frame[32];
+        snprintf(frame, sizeof(frame), "-frame%05d", i);
+        const std::string path = runner.output_path(frame);
+        if (path.empty() || !save_output(out, path, opts.output_format)) {
+          printf("Cannot write frame %d\n", i);
+        }
+      },
+      outs);
+  for (BufferParam<T> *in : inputs) {
+    in->set(first);
+  }
+  printf("Stream: %s\n", r.describe().c_str());
+}
+
+} // namespace HalideApps
+
+#endif
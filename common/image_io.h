@@ -0,0 +1,244 @@
+#ifndef COMMON_IMAGE_IO_H
+#define COMMON_IMAGE_IO_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "halide_image_io.h"
+#include "input_corpus.h"
+#include "padded_buffer.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// How the inputs of this process were obtained, for the I/O report
+struct InputStats {
+  int loaded = 0;
+  bool mapped = false;
+  double load_ms = 0;
+  // Kind of the last generated input, empty for files
+  std::string kind;
+};
+
+inline InputStats &input_stats() {
+  static InputStats stats;
+  return stats;
+}
+
+// A file mapped copy-on-write into memory, unmapped when destroyed. Pages
+// are read from the file on first touch, so a pipeline can start on a huge
+// input before it is all in memory.
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      return;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      return;
+    }
+    // Start reading ahead without waiting for it
+    madvise(p, st.st_size, MADV_WILLNEED);
+    addr = p;
+    bytes = st.st_size;
+  }
+  ~MappedFile() {
+    if (addr) {
+      munmap(addr, bytes);
+    }
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  void *data() const { return addr; }
+  size_t size() const { return bytes; }
+
+private:
+  void *addr = nullptr;
+  size_t bytes = 0;
+};
+
+// Mappings outlive the Buffers that wrap them: they last until exit
+inline std::vector<std::unique_ptr<MappedFile>> &mapped_files() {
+  static std::vector<std::unique_ptr<MappedFile>> files;
+  return files;
+}
+
+inline bool is_raw_path(const std::string &path) {
+  return path.size() > 4 && path.compare(path.size() - 4, 4, ".raw") == 0;
+}
+
+// Wrap the pages of a headerless file of packed rows of `width` elements of
+// type T as a Buffer, without copying. The height follows from the size.
+template <typename T> Buffer<T> map_raw(const std::string &path, int width) {
+  std::unique_ptr<MappedFile> file(new MappedFile(path));
+  const size_t row_bytes = size_t(width) * sizeof(T);
+  if (!file->data() || file->size() % row_bytes != 0) {
+    app_options_error("Cannot map a raw image of that width", path);
+  }
+  Buffer<T> b((T *)file->data(), width, int(file->size() / row_bytes));
+  mapped_files().push_back(std::move(file));
+  return b;
+}
+
+// Average the channels of `im` into `out`, scaled by `scale`
+template <typename S, typename T>
+void to_gray(const Buffer<S> &im, Buffer<T> &out, double scale) {
+  const int channels = im.dimensions() > 2 ? im.channels() : 1;
+  for (int y = 0; y < out.height(); y++) {
+    for (int x = 0; x < out.width(); x++) {
+      double sum = 0;
+      for (int c = 0; c < channels; c++) {
+        sum += im.dimensions() > 2 ? im(x, y, c) : im(x, y);
+      }
+      const double v = sum / channels * scale;
+      out(x, y) = std::is_integral<T>::value ? T(std::lround(v)) : T(v);
+    }
+  }
+}
+
+// Decode an image halide_image_io reads into a gray one of type T, with the
+// full range of the file mapped to [0, max_value]
+template <typename T>
+Buffer<T> decode_image(const std::string &path, bool pad, int max_value) {
+  Buffer<> im;
+  if (!Tools::load(path, &im)) {
+    app_options_error("Cannot read input", path);
+  }
+  Buffer<T> out = padded_buffer<T>(im.width(), im.height(), pad);
+  if (im.type() == UInt(8)) {
+    to_gray(im.as<uint8_t>(), out, max_value / 255.0);
+  } else if (im.type() == UInt(16)) {
+    to_gray(im.as<uint16_t>(), out, max_value / 65535.0);
+  } else {
+    app_options_error("Unsupported image type", path);
+  }
+  return out;
+}
+
+// The input image `index` of an app: the file --input lists at `index`, or
+// else a generated width x height image of `kind` with values in
+// [0, max_value]. Raw files are memory-mapped, with rows of --raw-width
+// elements (the app's width by default) and without the padding of --pad;
+// other files are decoded.
+template <typename T>
+Buffer<T> app_input(const AppOptions &opts, const std::string &kind,
+                    int width, int height, int max_value = 0xfff,
+                    size_t index = 0) {
+  InputStats &stats = input_stats();
+  double ms = 0;
+  Buffer<T> b;
+  if (index < opts.inputs.size()) {
+    const std::string &path = opts.inputs[index];
+    const bool raw = is_raw_path(path);
+    {
+      ScopeTimer timer(ms);
+      b = raw ? map_raw<T>(path, opts.raw_width ? opts.raw_width : width)
+              : decode_image<T>(path, opts.pad, max_value);
+    }
+    printf("Input %s: %dx%d, %s in %.2fms\n", path.c_str(), b.width(),
+           b.height(), raw ? "memory-mapped" : "decoded", ms);
+    stats.loaded++;
+    stats.mapped = stats.mapped || raw;
+    stats.load_ms += ms;
+    stats.kind.clear();
+    return b;
+  }
+  {
+    ScopeTimer timer(ms);
+    b = generate_input<T>(kind, width, height, max_value, opts.pad,
+                          int(index));
+  }
+  printf("Input %s: %dx%d, generated in %.2fms\n", kind.c_str(), b.width(),
+         b.height(), ms);
+  stats.kind = kind;
+  return b;
+}
+
+// Write `b` packed, row by row, as a raw image app_input() can map again
+template <typename T>
+bool save_raw(const Buffer<T> &b, const std::string &path) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = true;
+  for (int y = b.dim(1).min(); y <= b.dim(1).max() && ok; y++) {
+    ok = fwrite(&b(b.dim(0).min(), y), sizeof(T), b.width(), f) ==
+         size_t(b.width());
+  }
+  return fclose(f) == 0 && ok;
+}
+
+// Save `b` as 16-bit gray, its range stretched to the full 16 bits
+template <typename T>
+bool save_stretched(const Buffer<T> &b, const std::string &path) {
+  double lo = 0, hi = 0;
+  bool first = true;
+  b.for_each_value([&](T v) {
+    lo = first ? v : std::min(lo, double(v));
+    hi = first ? v : std::max(hi, double(v));
+    first = false;
+  });
+  const double scale = hi > lo ? 65535 / (hi - lo) : 0;
+  Buffer<uint16_t> out(b.width(), b.height());
+  for (int y = 0; y < b.height(); y++) {
+    for (int x = 0; x < b.width(); x++) {
+      const double v = b(b.dim(0).min() + x, b.dim(1).min() + y);
+      out(x, y) = uint16_t(std::lround((v - lo) * scale));
+    }
+  }
+  return Tools::save(out, path);
+}
+
+template <typename T>
+bool save_typed(const Buffer<T> &b, const std::string &path, bool raw) {
+  return raw ? save_raw(b, path) : save_stretched(b, path);
+}
+
+// Save an output of any of the types the apps produce, in the format of
+// --output-format
+inline bool save_output(const Buffer<> &b, const std::string &path,
+                        const std::string &format) {
+  const bool raw = format == "raw";
+  const Type t = b.type();
+  if (t == Float(32)) {
+    return save_typed(b.as<float>(), path, raw);
+  } else if (t == Int(32)) {
+    return save_typed(b.as<int32_t>(), path, raw);
+  } else if (t == UInt(32)) {
+    return save_typed(b.as<uint32_t>(), path, raw);
+  } else if (t == UInt(16)) {
+    return save_typed(b.as<uint16_t>(), path, raw);
+  } else if (t == UInt(8)) {
+    return save_typed(b.as<uint8_t>(), path, raw);
+  }
+  return false;
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef COMMON_INPUT_CORPUS_H
+#define COMMON_INPUT_CORPUS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "padded_buffer.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// The generated inputs, in the order --corpus=all runs them
+inline const std::vector<std::string> &corpus_kinds() {
+  static const std::vector<std::string> kinds = {
+      "noise", "gradient", "natural", "checker", "constant", "dark"};
+  return kinds;
+}
+
+// Position of `kind` in corpus_kinds(), or -1
+inline int corpus_index(const std::string &kind) {
+  const std::vector<std::string> &kinds = corpus_kinds();
+  auto it = std::find(kinds.begin(), kinds.end(), kind);
+  return it == kinds.end() ? -1 : int(it - kinds.begin());
+}
+
+// The inputs an app runs on in turn: the kinds --corpus lists, or "file"
+// for the images of --input
+inline std::vector<std::string> corpus_kinds(const AppOptions &opts) {
+  if (!opts.inputs.empty()) {
+    return {"file"};
+  }
+  if (opts.corpus == "all") {
+    return corpus_kinds();
+  }
+  std::vector<std::string> kinds = split_list(opts.corpus);
+  for (const std::string &kind : kinds) {
+    if (corpus_index(kind) < 0) {
+      app_options_error("Expected --corpus=all or a list of noise, "
+                        "gradient, natural, checker, constant and dark",
+                        opts.corpus);
+    }
+  }
+  return kinds;
+}
+
+// Value noise with an amplitude spectrum falling as 1/f, like that of
+// natural images: octaves of bilinearly interpolated random lattices, each
+// with half the cell size and half the amplitude of the one before. Values
+// are in [0, 1].
+inline std::vector<float> fractal_noise(int width, int height,
+                                        std::mt19937 &rng) {
+  std::vector<float> v(size_t(width) * height, 0.0f);
+  std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+  float amplitude = 1, total = 0;
+  for (int cell = std::max(width, height) / 2; cell >= 2; cell /= 2) {
+    const int gw = width / cell + 2, gh = height / cell + 2;
+    std::vector<float> lattice(size_t(gw) * gh);
+    for (float &l : lattice) {
+      l = uniform(rng);
+    }
+    for (int y = 0; y < height; y++) {
+      const int gy = y / cell;
+      const float fy = float(y % cell) / cell;
+      for (int x = 0; x < width; x++) {
+        const int gx = x / cell;
+        const float fx = float(x % cell) / cell;
+        const float *l = &lattice[size_t(gy) * gw + gx];
+        const float top = l[0] + (l[1] - l[0]) * fx;
+        const float bottom = l[gw] + (l[gw + 1] - l[gw]) * fx;
+        v[size_t(y) * width + x] += amplitude * (top + (bottom - top) * fy);
+      }
+    }
+    total += amplitude;
+    amplitude /= 2;
+  }
+  for (float &f : v) {
+    f /= total;
+  }
+  return v;
+}
+
+// A deterministic width x height input of the given kind, with values in
+// [0, max_value]. `index` tells apart the inputs of apps that take several.
+//   noise:    independent uniform values, the default
+//   gradient: a smooth diagonal ramp
+//   natural:  1/f fractal noise with a few sharp-edged occluding discs
+//   checker:  16x16 squares of 0 and max_value, an edge every 16 pixels
+//   constant: max_value / 2 everywhere
+//   dark:     a low-light frame, natural content at 4% of the range with
+//             shot noise, as night scenes are
+template <typename T>
+Buffer<T> generate_input(const std::string &kind, int width, int height,
+                         int max_value, bool pad, int index = 0) {
+  std::mt19937 rng(0x5eed + 7919 * index + corpus_index(kind));
+  std::vector<float> v(size_t(width) * height);
+  if (kind == "noise") {
+    std::uniform_int_distribution<int> uniform(0, max_value);
+    for (float &f : v) {
+      f = uniform(rng);
+    }
+  } else if (kind == "gradient") {
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        v[size_t(y) * width + x] =
+            max_value * 0.5f *
+            (float(x) / std::max(width - 1, 1) +
+             float(y) / std::max(height - 1, 1));
+      }
+    }
+  } else if (kind == "natural" || kind == "dark") {
+    v = fractal_noise(width, height, rng);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for (int d = 0; d < 16; d++) {
+      const float cx = uniform(rng) * width, cy = uniform(rng) * height;
+      const float r = (0.02f + 0.08f * uniform(rng)) * width;
+      const float shade = uniform(rng);
+      for (int y = std::max(0, int(cy - r));
+           y < std::min(height, int(cy + r) + 1); y++) {
+        for (int x = std::max(0, int(cx - r));
+             x < std::min(width, int(cx + r) + 1); x++) {
+          if ((x - cx) * (x - cx) + (y - cy) * (y - cy) <= r * r) {
+            v[size_t(y) * width + x] = shade;
+          }
+        }
+      }
+    }
+    const float gain = kind == "dark" ? 0.04f * max_value : float(max_value);
+    std::normal_distribution<float> unit(0.0f, 1.0f);
+    for (float &f : v) {
+      f *= gain;
+      if (kind == "dark") {
+        // Shot noise, with the variance of a Poisson count of photons
+        f = std::min(std::max(f + std::sqrt(f + 1) * unit(rng), 0.0f),
+                     float(max_value));
+      }
+    }
+  } else if (kind == "checker") {
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        v[size_t(y) * width + x] = ((x / 16 + y / 16) % 2) * max_value;
+      }
+    }
+  } else {
+    std::fill(v.begin(), v.end(), max_value / 2);
+  }
+
+  Buffer<T> b = padded_buffer<T>(width, height, pad);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const float f = v[size_t(y) * width + x];
+      b(x, y) = std::is_integral<T>::value ? T(std::lround(f)) : T(f);
+    }
+  }
+  return b;
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef COMMON_MANUAL_SCHEDULE_H
+#define COMMON_MANUAL_SCHEDULE_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "schedule_cache.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Where a producer is computed relative to the tiles of its consumer
+enum class ComputeLevel {
+  Root, // all of it ahead of the consumer, tiled and parallel on its own
+  Tile, // per consumer tile, over the tile plus its halo
+  Row,  // per row of a consumer tile, keeping the rows computed so far for
+        // the rest of the tile (a sliding window); per tile on GPUs
+};
+
+// Knobs of the hand-written schedules
+struct ScheduleParams {
+  // Output tile on CPUs; GPU schedules use 32x8 thread blocks
+  int tile_x = 128, tile_y = 32;
+  // Vector width, 0 for the natural width of each Func's type
+  int vector = 0;
+  // Consecutive tiles per parallel task
+  int task_tiles = 1;
+  // Level of the intermediates an app leaves to the default
+  ComputeLevel level = ComputeLevel::Tile;
+};
+
+// Schedules to run: auto (false), manual (true), or both
+inline std::vector<bool> schedule_modes(const AppOptions &opts) {
+  if (opts.schedule == "auto") {
+    return {false};
+  } else if (opts.schedule == "manual") {
+    return {true};
+  }
+  return {false, true};
+}
+
+// Builder for the hand-written schedule of a pipeline. Outputs are tiled,
+// with tiles run in parallel and vectorized along x, and each producer is
+// placed relative to the tiles of a consumer scheduled before it:
+//
+//   ManualSchedule s(target, params);
+//   s.output(output).producer(blur, ComputeLevel::Row);
+//   s.finish();
+//
+// Everything not placed stays inlined, except Funcs with update
+// definitions, which Halide cannot inline; finish() places those.
+class ManualSchedule {
+public:
+  ManualSchedule(const Target &target, const ScheduleParams &params)
+      : target(target), params(params) {}
+
+  ManualSchedule &output(Func f) {
+    outputs.push_back(f);
+    tile(f, true);
+    return *this;
+  }
+
+  // Compute `g` at `level` within the tiles of `consumer`
+  ManualSchedule &producer(Func g, ComputeLevel level, Func consumer) {
+    place(g, level, consumer.name());
+    return *this;
+  }
+
+  // Same, within the tiles of the first output
+  ManualSchedule &producer(Func g, ComputeLevel level) {
+    place(g, level, outputs[0].name());
+    return *this;
+  }
+
+  ManualSchedule &producer(Func g) { return producer(g, params.level); }
+
+  // Compute each remaining Func with update definitions in the tiles of the
+  // nearest scheduled Func that consumes it, or at root if there are several
+  void finish() {
+    env = pipeline_functions(outputs);
+    for (auto &it : env) {
+      for (auto &callee : Internal::find_direct_calls(it.second)) {
+        consumers[callee.first].insert(it.first);
+      }
+    }
+    for (auto &it : env) {
+      if (!it.second.updates().empty()) {
+        place_reduction(it.first);
+      }
+    }
+  }
+
+private:
+  // Loops of a scheduled Func that producers can be computed at
+  struct Loops {
+    LoopLevel tile, row;
+  };
+
+  Target target;
+  ScheduleParams params;
+  std::vector<Func> outputs;
+  std::map<std::string, Loops> loops;
+  std::map<std::string, Internal::Function> env;
+  std::map<std::string, std::set<std::string>> consumers;
+
+  const int gpu_tile_x = 32, gpu_tile_y = 8;
+
+  int lanes(const Func &g) const {
+    return params.vector ? params.vector
+                         : target.natural_vector_size(g.output_types()[0]);
+  }
+
+  // Tile every stage of `g` over (x, y). Outputs guard partial tiles so that
+  // small regions such as border strips are not overrun; intermediates
+  // shift them inwards instead.
+  void tile(Func g, bool is_output) {
+    Var x = g.args()[0], y = g.args()[1];
+    Var xo, yo, xi, yi, t, task, ti;
+    TailStrategy tail =
+        is_output ? TailStrategy::GuardWithIf : TailStrategy::Auto;
+    if (!is_output) {
+      g.compute_root();
+    }
+    if (target.has_gpu_feature()) {
+      g.gpu_tile(x, y, xo, yo, xi, yi, gpu_tile_x, gpu_tile_y, tail);
+      loops[g.name()] = {LoopLevel(g, xo), LoopLevel(g, xo)};
+    } else {
+      g.tile(x, y, xo, yo, xi, yi, params.tile_x, params.tile_y, tail)
+          .fuse(xo, yo, t)
+          .split(t, task, ti, params.task_tiles)
+          .parallel(task)
+          .vectorize(xi, lanes(g));
+      loops[g.name()] = {LoopLevel(g, ti), LoopLevel(g, yi)};
+    }
+    for (int i = 0; i < g.num_update_definitions(); i++) {
+      if (target.has_gpu_feature()) {
+        g.update(i).gpu_tile(x, y, xo, yo, xi, yi, gpu_tile_x, gpu_tile_y,
+                             tail);
+      } else {
+        x_innermost(g, i)
+            .split(y, yo, yi, params.tile_y, tail)
+            .parallel(yo)
+            .vectorize(x, lanes(g), tail);
+      }
+    }
+  }
+
+  // Move x inside the reduction loops of update `i` of `g`, so that each
+  // tap is applied to a whole vector of outputs
+  static Stage x_innermost(Func g, int i) {
+    const Internal::Function fn = g.function();
+    const std::string x = g.args()[0].name();
+    std::vector<VarOrRVar> order = {g.args()[0]};
+    for (const Internal::Dim &d : fn.update(i).schedule().dims()) {
+      if (d.var != x && d.var != Var::outermost().name()) {
+        order.push_back(VarOrRVar(d.var, d.is_rvar()));
+      }
+    }
+    return g.update(i).reorder(order);
+  }
+
+  void place(Func g, ComputeLevel level, const std::string &consumer) {
+    if (level == ComputeLevel::Root) {
+      tile(g, false);
+      return;
+    }
+    const Loops at = loops.at(consumer);
+    if (level == ComputeLevel::Row) {
+      g.store_at(at.tile).compute_at(at.row);
+    } else {
+      g.compute_at(at.tile);
+    }
+    // Producers of `g` go in the same tiles
+    loops[g.name()] = at;
+
+    Var x = g.args()[0], y = g.args()[1];
+    if (target.has_gpu_feature()) {
+      g.gpu_threads(x, y);
+      for (int i = 0; i < g.num_update_definitions(); i++) {
+        g.update(i).gpu_threads(x, y);
+      }
+    } else {
+      g.vectorize(x, lanes(g));
+      for (int i = 0; i < g.num_update_definitions(); i++) {
+        x_innermost(g, i).vectorize(x, lanes(g));
+      }
+    }
+  }
+
+  // Place reduction `name` after the reductions that consume it, looking
+  // through the inlined Funcs in between
+  void place_reduction(const std::string &name) {
+    if (loops.count(name)) {
+      return;
+    }
+    std::set<std::string> at;
+    std::vector<std::string> pending(consumers[name].begin(),
+                                     consumers[name].end());
+    std::set<std::string> seen;
+    while (!pending.empty()) {
+      std::string c = pending.back();
+      pending.pop_back();
+      if (!seen.insert(c).second) {
+        continue;
+      }
+      if (!loops.count(c) && !env.at(c).updates().empty()) {
+        place_reduction(c);
+      }
+      if (loops.count(c)) {
+        at.insert(c);
+      } else {
+        pending.insert(pending.end(), consumers[c].begin(),
+                       consumers[c].end());
+      }
+    }
+    Func g(env.at(name));
+    place(g, at.size() == 1 ? ComputeLevel::Tile : ComputeLevel::Root,
+          at.empty() ? "" : *at.begin());
+  }
+};
+
+} // namespace HalideApps
+
+#endif
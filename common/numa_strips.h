@@ -0,0 +1,286 @@
+#ifndef COMMON_NUMA_STRIPS_H
+#define COMMON_NUMA_STRIPS_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Halide.h"
+#include "app_options.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "frame_parallel.h"
+#include "pipeline_runner.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// A NUMA node and the CPUs of the process on it
+struct NumaNode {
+  int id = 0;
+  std::vector<int> cpus;
+};
+
+// The NUMA nodes the process may run on, from sysfs, with only the CPUs of
+// its affinity mask. A positive `simulated` splits those CPUs into that many
+// nodes of consecutive CPUs instead, to try the partitioning on one socket
+// or within a numactl binding. A host without NUMA information is one node.
+inline std::vector<NumaNode> numa_nodes(int simulated) {
+  const std::vector<int> allowed = allowed_cpus();
+  std::vector<NumaNode> nodes;
+  if (simulated > 0) {
+    const int64_t n = allowed.size();
+    for (int i = 0; i < simulated; i++) {
+      NumaNode node;
+      node.id = (int)nodes.size();
+      node.cpus.assign(allowed.begin() + n * i / simulated,
+                       allowed.begin() + n * (i + 1) / simulated);
+      if (!node.cpus.empty()) {
+        nodes.push_back(node);
+      }
+    }
+    return nodes;
+  }
+  const std::string sysfs = "/sys/devices/system/node/";
+  for (int id : parse_cpu_list(read_sysfs(sysfs + "online"))) {
+    NumaNode node;
+    node.id = id;
+    const std::string list =
+        read_sysfs(sysfs + "node" + std::to_string(id) + "/cpulist");
+    for (int c : parse_cpu_list(list)) {
+      if (std::find(allowed.begin(), allowed.end(), c) != allowed.end()) {
+        node.cpus.push_back(c);
+      }
+    }
+    if (!node.cpus.empty()) {
+      nodes.push_back(node);
+    }
+  }
+  if (nodes.empty()) {
+    NumaNode node;
+    node.cpus = allowed;
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+// The output rows one node produces, the input they read, and the pipelines
+// that realize them
+template <typename In, typename Out> struct NumaStrip {
+  NumaNode node;
+  Rect rows, reads;
+  Buffer<In> input;
+  Buffer<Out> output;
+  std::shared_ptr<PipelineRunner> runner;
+  // Time of its last realization
+  double ms = 0;
+};
+
+// One thread per strip, pinned to the CPUs of its node. Each first touches
+// the buffers of its strip, so that their pages are placed on that node,
+// then realizes the strip with its loops on a TaskSlice of the node's CPUs
+// whenever run() is called.
+template <typename In, typename Out> class StripWorkers {
+public:
+  StripWorkers(std::vector<NumaStrip<In, Out>> &strips,
+               const Buffer<In> &input)
+      : strips(strips) {
+    for (size_t s = 0; s < strips.size(); s++) {
+      threads.emplace_back([this, s, &input]() { work(s, input); });
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return ready == (int)this->strips.size(); });
+  }
+
+  ~StripWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) {
+      t.join();
+    }
+  }
+
+  StripWorkers(const StripWorkers &) = delete;
+  StripWorkers &operator=(const StripWorkers &) = delete;
+
+  // Realize every strip once, all at the same time
+  void run() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending = (int)strips.size();
+      generation++;
+    }
+    wake.notify_all();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return pending == 0; });
+  }
+
+private:
+  std::vector<NumaStrip<In, Out>> &strips;
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  bool stopping = false;
+  uint64_t generation = 0;
+  int ready = 0, pending = 0;
+
+  void work(size_t s, const Buffer<In> &input) {
+    NumaStrip<In, Out> &strip = strips[s];
+    pin_current_thread(strip.node.cpus);
+    strip.input = Buffer<In>(strip.reads.width, strip.reads.height);
+    strip.input.set_min(strip.reads.x, strip.reads.y);
+    strip.input.copy_from(input);
+    strip.output = Buffer<Out>(strip.rows.width, strip.rows.height);
+    strip.output.set_min(strip.rows.x, strip.rows.y);
+    strip.output.fill(0);
+    TaskSlice slice((int)strip.node.cpus.size(), strip.node.cpus);
+    slice.enter();
+
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (++ready == (int)strips.size()) {
+      done.notify_all();
+    }
+    while (true) {
+      wake.wait(lock, [&]() { return stopping || generation != seen; });
+      if (stopping) {
+        break;
+      }
+      seen = generation;
+      lock.unlock();
+      const auto t = std::chrono::steady_clock::now();
+      strip.runner->realize({strip.output});
+      strip.ms = ms_since(t);
+      lock.lock();
+      if (--pending == 0) {
+        done.notify_all();
+      }
+    }
+    lock.unlock();
+    TaskSlice::leave();
+  }
+};
+
+// With --numa, realize `region` of the output of a large image as one
+// horizontal strip of rows per NUMA node, each strip from a private copy of
+// the input rows it reads, halo included, and into an output of its own,
+// both first touched on that node, and with its parallel loops on that
+// node's CPUs only. `make` builds and compiles the pipelines of one strip
+// from its input and rows; the halo covers `footprint`, so the boundary
+// condition of the strip applies only at the edges of the image, as it does
+// for the whole. Strips get rows in proportion to the CPUs of their node.
+// Reports the time per call against `whole_ms`, the default realization of
+// the whole region into `whole`, and checks the strips against `whole`.
+// CPU targets only: GPU kernels do not run on the thread pool.
+template <typename In, typename Out>
+void run_numa_strips(
+    const AppOptions &opts, const Target &target, const Buffer<In> &input,
+    const Buffer<Out> &whole, const Rect &region, const Footprint &footprint,
+    double whole_ms,
+    std::function<std::shared_ptr<PipelineRunner>(const Buffer<In> &,
+                                                  const Rect &)>
+        make) {
+  if (opts.numa == "off") {
+    return;
+  }
+  if (target.has_gpu_feature()) {
+    printf("NUMA strips: CPU targets only\n");
+    return;
+  }
+  if (opts.profile || opts.trace) {
+    printf("NUMA strips: not with --profile or --trace\n");
+    return;
+  }
+  const std::vector<NumaNode> nodes =
+      numa_nodes(opts.numa == "on" ? 0 : atoi(opts.numa.c_str()));
+  size_t cpus = 0;
+  for (const NumaNode &node : nodes) {
+    cpus += node.cpus.size();
+  }
+  if (cpus == 0) {
+    printf("NUMA strips: cannot read the CPUs of the process\n");
+    return;
+  }
+  const int min_y = input.dim(1).min(), max_y = input.dim(1).max();
+  Rect reads;
+  reads.x = std::max(input.dim(0).min(), region.x + footprint.min_x);
+  reads.width = std::min(input.dim(0).max(),
+                         region.x + region.width - 1 + footprint.max_x) -
+                reads.x + 1;
+  std::vector<NumaStrip<In, Out>> strips;
+  size_t before = 0;
+  for (const NumaNode &node : nodes) {
+    NumaStrip<In, Out> strip;
+    strip.node = node;
+    const int y0 = region.y + (int)(int64_t(region.height) * before / cpus);
+    before += node.cpus.size();
+    const int y1 = region.y + (int)(int64_t(region.height) * before / cpus);
+    if (y1 == y0) {
+      continue;
+    }
+    strip.rows = region;
+    strip.rows.y = y0;
+    strip.rows.height = y1 - y0;
+    strip.reads = reads;
+    strip.reads.y = std::max(min_y, y0 + footprint.min_y);
+    strip.reads.height =
+        std::min(max_y, y1 - 1 + footprint.max_y) - strip.reads.y + 1;
+    strips.push_back(strip);
+  }
+
+  StripWorkers<In, Out> workers(strips, input);
+  for (NumaStrip<In, Out> &strip : strips) {
+    strip.runner = make(strip.input, strip.rows);
+    strip.runner->set_do_par_for(TaskSlice::halide_do_par_for);
+  }
+  BenchResult r = run_benchmark(bench_config(opts), [&]() { workers.run(); });
+  // Strips of the same shape can share a cached object, whose hook each
+  // records as it finds it, so restore them in reverse
+  for (size_t s = strips.size(); s-- > 0;) {
+    strips[s].runner->set_do_par_for(nullptr);
+  }
+
+  std::string split;
+  double slowest = 0, fastest = 0;
+  int64_t mismatches = 0;
+  for (const NumaStrip<In, Out> &strip : strips) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s%d rows on node %d (%zu CPUs)",
+             split.empty() ? "" : ", ", strip.rows.height, strip.node.id,
+             strip.node.cpus.size());
+    split += buf;
+    slowest = std::max(slowest, strip.ms);
+    fastest = fastest == 0 ? strip.ms : std::min(fastest, strip.ms);
+    const Buffer<Out> &out = strip.output;
+    out.for_each_element([&](int x, int y) {
+      mismatches += out(x, y) != whole(x, y);
+    });
+  }
+  printf("NUMA strips: %s, halo %d+%d rows: %.4gms per call against %.4gms "
+         "for the whole image on all threads, %.2fx; last call's strips "
+         "%.4gms to %.4gms\n",
+         split.c_str(), -footprint.min_y, footprint.max_y, r.median_ms,
+         whole_ms, r.median_ms > 0 ? whole_ms / r.median_ms : 0, fastest,
+         slowest);
+  if (mismatches > 0) {
+    printf("NUMA strips: %lld pixels differ from the whole image\n",
+           (long long)mismatches);
+  }
+}
+
+} // namespace HalideApps
+
+#endif
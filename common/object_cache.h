@@ -0,0 +1,289 @@
+#ifndef COMMON_OBJECT_CACHE_H
+#define COMMON_OBJECT_CACHE_H
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Halide.h"
+#include "arena_allocator.h"
+#include "schedule_cache.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Directory of cached pipeline objects, HL_OBJECT_CACHE or ./object_cache
+inline std::string object_cache_dir() {
+  const char *dir = getenv("HL_OBJECT_CACHE");
+  return dir ? dir : "object_cache";
+}
+
+// The buffers and parameters a pipeline reads, by name. Buffers of
+// ImageParams are those bound when the pipeline is visited; the ImageParams
+// themselves are in `params` too.
+class FindPipelineInputs : public Internal::IRGraphVisitor {
+public:
+  std::map<std::string, Buffer<>> buffers;
+  std::map<std::string, Internal::Parameter> params;
+
+  void include_pipeline(const std::vector<Func> &outputs) {
+    for (auto &it : pipeline_functions(outputs)) {
+      const Internal::Function &fn = it.second;
+      std::vector<Internal::Definition> defs = {fn.definition()};
+      defs.insert(defs.end(), fn.updates().begin(), fn.updates().end());
+      for (const Internal::Definition &d : defs) {
+        for (const Expr &e : d.args()) {
+          e.accept(this);
+        }
+        for (const Expr &e : d.values()) {
+          e.accept(this);
+        }
+        for (const Internal::ReductionVariable &rv : d.schedule().rvars()) {
+          rv.min.accept(this);
+          rv.extent.accept(this);
+        }
+      }
+    }
+  }
+
+protected:
+  using Internal::IRGraphVisitor::visit;
+
+  void visit(const Internal::Call *op) override {
+    Internal::IRGraphVisitor::visit(op);
+    if (op->image.defined()) {
+      buffers[op->image.name()] = op->image;
+    } else if (op->param.defined() && op->param.is_buffer()) {
+      buffers[op->param.name()] = op->param.buffer();
+      params[op->param.name()] = op->param;
+    }
+  }
+
+  void visit(const Internal::Variable *op) override {
+    if (op->param.defined() && !op->param.is_buffer()) {
+      params[op->param.name()] = op->param;
+    }
+  }
+};
+
+// Run `argv[0]` from the PATH with `argv`, without a shell, and wait for
+// it; true if it exits with 0. Prints why otherwise.
+inline bool run_command(const std::vector<std::string> &argv) {
+  std::vector<char *> args;
+  for (const std::string &a : argv) {
+    args.push_back(const_cast<char *>(a.c_str()));
+  }
+  args.push_back(nullptr);
+  const pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "Cannot run %s: %s\n", args[0], strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    execvp(args[0], args.data());
+    _exit(127);
+  }
+  int status = 0;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      fprintf(stderr, "Cannot wait for %s: %s\n", args[0], strerror(errno));
+      return false;
+    }
+  }
+  if (!WIFEXITED(status)) {
+    fprintf(stderr, "%s killed by signal %d\n", args[0], WTERMSIG(status));
+    return false;
+  } else if (WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s exited with %d\n", args[0], WEXITSTATUS(status));
+    return false;
+  }
+  return true;
+}
+
+// `text` of a lowered pipeline with the names Halide numbers per process
+// replaced by names numbered in the order the text first uses them: those
+// of a letter and a counter, such as f27 or t5, and those made unique with
+// a `$n` suffix, such as x$2. The same pipeline built after other objects in
+// the process, or in another process, then has the same text.
+inline std::string canonical_stmt(const std::string &text) {
+  std::map<std::string, std::string> names;
+  std::map<std::string, int> counts;
+  std::string out, token;
+  auto rename = [&]() {
+    const size_t dollar = token.find('$');
+    std::string kind;
+    if (dollar != std::string::npos) {
+      kind = token.substr(0, dollar + 1);
+    } else if (token.size() > 1 && isalpha((unsigned char)token[0]) &&
+               std::all_of(token.begin() + 1, token.end(), [](char c) {
+                 return isdigit((unsigned char)c);
+               })) {
+      kind = token.substr(0, 1) + "_";
+    }
+    if (kind.empty()) {
+      out += token;
+    } else {
+      auto it = names.find(token);
+      if (it == names.end()) {
+        it = names.emplace(token, kind + std::to_string(counts[kind]++)).first;
+      }
+      out += it->second;
+    }
+    token.clear();
+  };
+  for (char c : text) {
+    if (isalnum((unsigned char)c) || c == '_' || c == '$') {
+      token += c;
+      continue;
+    }
+    rename();
+    out += c;
+  }
+  rename();
+  return out;
+}
+
+// Key of the object of `p` compiled with `args` for `target`: a hash of
+// its lowered statement, with canonical names, and the target. Lowers the
+// pipeline through a temporary file in `dir`.
+inline std::string object_cache_key(Pipeline &p,
+                                    const std::vector<Argument> &args,
+                                    const Target &target,
+                                    const std::string &dir) {
+  const std::string stmt_path =
+      dir + "/lowered-" + std::to_string(getpid()) + ".stmt";
+  p.compile_to_lowered_stmt(stmt_path, args, Text, target);
+  std::ifstream stmt(stmt_path);
+  std::ostringstream text;
+  text << stmt.rdbuf();
+  unlink(stmt_path.c_str());
+  return fnv1a(canonical_stmt(text.str()) + target.to_string());
+}
+
+// A pipeline compiled ahead of time into a shared object and loaded with
+// dlopen, so that a process that finds it in the cache skips LLVM codegen
+// and linking. The object is keyed by object_cache_key(), so a hit still
+// pays for lowering; key_ms() gives that time.
+// Input buffers are arguments of the object rather than embedded constants,
+// and are bound by name on every call; ImageParams to the buffer they hold
+// then.
+//
+// The object carries its own Halide runtime, so only CPU targets are cached:
+// device allocations made through the JIT runtime would not be valid in it.
+class ObjectPipeline {
+public:
+  static bool supported(const Target &target) {
+    return !target.has_gpu_feature();
+  }
+
+  // Load the object for `p` from the cache, compiling and storing it first
+  // on a miss. Sets `hit` to whether it was already cached.
+  bool load(Pipeline &p, const std::vector<Func> &outputs,
+            const Target &target, bool &hit) {
+    args = p.infer_arguments();
+    inputs.include_pipeline(outputs);
+
+    const std::string dir = object_cache_dir();
+    if (!make_dirs(dir)) {
+      return false;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const std::string key = object_cache_key(p, args, target, dir);
+    key_time_ms = ms_since(start);
+
+    const std::string name = "pipeline_" + key;
+    const std::string so_path = dir + "/" + key + ".so";
+    hit = access(so_path.c_str(), R_OK) == 0;
+    if (!hit) {
+      const std::string obj_path = dir + "/" + key + ".o";
+      p.compile_to_object(obj_path, args, name, target);
+      const bool linked = run_command(
+          {"cc", "-shared", "-o", so_path, obj_path, "-ldl", "-lpthread"});
+      unlink(obj_path.c_str());
+      if (!linked) {
+        return false;
+      }
+    }
+
+    handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+      return false;
+    }
+    entry = (int (*)(void **))dlsym(handle, (name + "_argv").c_str());
+    install_allocator();
+    return entry != nullptr;
+  }
+
+  // Time load() spent lowering the pipeline for its key
+  double key_ms() const { return key_time_ms; }
+
+  // Realize into `outs`; returns the error code of the object, 0 on success
+  int realize(const std::vector<Buffer<>> &outs) {
+    std::vector<void *> argv;
+    std::vector<Buffer<>> bound;
+    bound.reserve(args.size());
+    for (const Argument &a : args) {
+      if (a.is_buffer()) {
+        auto p = inputs.params.find(a.name);
+        bound.push_back(p != inputs.params.end() ? p->second.buffer()
+                                                 : inputs.buffers[a.name]);
+        argv.push_back(bound.back().raw_buffer());
+      } else {
+        argv.push_back(inputs.params[a.name].scalar_address());
+      }
+    }
+    for (const Buffer<> &b : outs) {
+      argv.push_back(b.raw_buffer());
+    }
+    return entry(argv.data());
+  }
+
+  // Route the parallel loops of the object, and of every other pipeline
+  // loaded from the same file, to `f`; returns the hook they went to before.
+  // Calls are reentrant, so threads with their own outputs can share one
+  // object.
+  halide_do_par_for_t set_do_par_for(halide_do_par_for_t f) {
+    auto set = (halide_do_par_for_t(*)(halide_do_par_for_t))dlsym(
+        handle, "halide_set_custom_do_par_for");
+    return set ? set(f) : nullptr;
+  }
+
+private:
+  std::vector<Argument> args;
+  FindPipelineInputs inputs;
+  void *handle = nullptr;
+  int (*entry)(void **) = nullptr;
+  double key_time_ms = 0;
+
+  // Route the object's own halide_malloc/halide_free to the arena, as the
+  // JIT pipelines are
+  void install_allocator() {
+    typedef void *(*malloc_fn)(void *, size_t);
+    typedef void (*free_fn)(void *, void *);
+    auto set_malloc = (malloc_fn(*)(malloc_fn))dlsym(
+        handle, "halide_set_custom_malloc");
+    auto set_free = (free_fn(*)(free_fn))dlsym(handle, "halide_set_custom_free");
+    if (set_malloc && set_free) {
+      set_malloc(ArenaAllocator::halide_malloc);
+      set_free(ArenaAllocator::halide_free);
+    }
+  }
+};
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef COMMON_PADDED_BUFFER_H
+#define COMMON_PADDED_BUFFER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+const int cache_line_bytes = 64;
+
+// Row pitch, in elements, for rows of `width` elements of `elem_bytes` each.
+// Rows are rounded up to whole cache lines, and to an odd number of them, so
+// that the rows a vertical stencil reads map to different cache sets instead
+// of aliasing as power-of-two pitches do.
+inline int padded_pitch(int width, int elem_bytes) {
+  int lines = (width * elem_bytes + cache_line_bytes - 1) / cache_line_bytes;
+  if (lines % 2 == 0) {
+    lines++;
+  }
+  return lines * cache_line_bytes / elem_bytes;
+}
+
+// A width x height image whose rows are padded_pitch() elements apart.
+// Halide aligns allocations to 128 bytes, so every row starts on a cache
+// line. Without `pad` the rows are packed.
+template <typename T>
+Buffer<T> padded_buffer(int width, int height, bool pad = true) {
+  if (!pad) {
+    return Buffer<T>(width, height);
+  }
+  Buffer<T> b(padded_pitch(width, sizeof(T)), height);
+  b.crop(0, 0, width);
+  return b;
+}
+
+// Align the rows of every compute_root intermediate of `outputs` to cache
+// lines. Halide only lets a schedule round storage extents up, so these
+// rows are aligned but not skewed like padded_buffer() rows.
+inline void align_intermediates(const std::vector<Func> &outputs) {
+  std::map<std::string, Internal::Function> env;
+  for (const Func &f : outputs) {
+    std::map<std::string, Internal::Function> calls =
+        Internal::find_transitive_calls(f.function());
+    env.insert(calls.begin(), calls.end());
+  }
+  for (const Func &f : outputs) {
+    env.erase(f.name());
+  }
+  for (auto &it : env) {
+    const Internal::Function &fn = it.second;
+    LoopLevel level = fn.schedule().compute_level();
+    level.lock();
+    if (!level.is_root() || fn.dimensions() == 0) {
+      continue;
+    }
+    int lanes = cache_line_bytes / fn.output_types()[0].bytes();
+    if (lanes > 1) {
+      Func(fn).align_storage(Var(fn.args()[0]), lanes);
+    }
+  }
+}
+
+} // namespace HalideApps
+
+#endif
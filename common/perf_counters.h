@@ -0,0 +1,254 @@
+#ifndef COMMON_PERF_COUNTERS_H
+#define COMMON_PERF_COUNTERS_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace HalideApps {
+
+// Hardware events counted by PerfCounters, in report order
+enum PerfEvent {
+  Cycles,
+  Instructions,
+  L1DMisses,
+  LLCMisses,
+  BranchMisses,
+  DTLBMisses,
+  NumPerfEvents
+};
+
+// Event counts summed over threads. Events the CPU or kernel does not
+// support are marked absent.
+struct PerfCounts {
+  double count[NumPerfEvents] = {};
+  bool present[NumPerfEvents] = {};
+
+  PerfCounts operator+(const PerfCounts &o) const {
+    PerfCounts r = *this;
+    for (int e = 0; e < NumPerfEvents; e++) {
+      r.count[e] += o.count[e];
+      r.present[e] = present[e] || o.present[e];
+    }
+    return r;
+  }
+
+  PerfCounts operator-(const PerfCounts &o) const {
+    PerfCounts r = *this;
+    for (int e = 0; e < NumPerfEvents; e++) {
+      r.count[e] -= o.count[e];
+    }
+    return r;
+  }
+
+  // Counts per call, in millions, and the IPC
+  std::string describe(int calls) const {
+    static const char *names[NumPerfEvents] = {
+        "cycles", "instr", "L1D miss", "LLC miss", "branch miss", "dTLB miss"};
+    std::string s = "per call";
+    char buf[64];
+    for (int e = 0; e < NumPerfEvents; e++) {
+      if (present[e]) {
+        snprintf(buf, sizeof(buf), " %.3gM %s", count[e] / calls / 1e6,
+                 names[e]);
+        s += buf;
+      }
+    }
+    if (present[Cycles] && present[Instructions] && count[Cycles] > 0) {
+      snprintf(buf, sizeof(buf), ", %.2f IPC",
+               count[Instructions] / count[Cycles]);
+      s += buf;
+    }
+    return s;
+  }
+};
+
+// Linux perf_event_open counters on every thread of the process, so that
+// work done by the Halide thread pool is counted along with the calling
+// thread. Threads created after open() are not counted, so open once the
+// thread pool has started. Each thread gets one group, read in a single
+// call and scaled up if the kernel had to multiplex it.
+class PerfCounters {
+public:
+  PerfCounters() = default;
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+  ~PerfCounters() { close_all(); }
+
+  // Returns false, with the reason in error(), if no counter can be opened,
+  // e.g. for lack of permission (see /proc/sys/kernel/perf_event_paranoid)
+  bool open() {
+    close_all();
+    std::vector<pid_t> tids = threads();
+    for (pid_t tid : tids) {
+      Group g;
+      bool exited = false;
+      for (int e = 0; e < NumPerfEvents && !exited; e++) {
+        if (!groups.empty() && !has_event(e)) {
+          continue; // not supported on the first thread
+        }
+        int fd = open_event(e, tid, g.fds.empty() ? -1 : g.fds[0]);
+        if (fd >= 0) {
+          g.fds.push_back(fd);
+          if (groups.empty()) {
+            events.push_back(e);
+          }
+        } else if (errno == ESRCH) {
+          exited = true;
+        } else if (!groups.empty() || errno == EACCES || errno == EPERM) {
+          reason = strerror(errno);
+          close_group(g);
+          close_all();
+          return false;
+        }
+      }
+      if (exited) {
+        close_group(g);
+        if (groups.empty()) {
+          events.clear();
+        }
+        continue;
+      }
+      if (g.fds.empty()) {
+        reason = "no hardware events available";
+        close_all();
+        return false;
+      }
+      groups.push_back(g);
+    }
+    if (groups.empty()) {
+      reason = "no threads to count";
+      return false;
+    }
+    for (const Group &g : groups) {
+      ioctl(g.fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(g.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    return true;
+  }
+
+  bool is_open() const { return !groups.empty(); }
+
+  const std::string &error() const { return reason; }
+
+  PerfCounts read_counts() const {
+    PerfCounts c;
+    for (int e : events) {
+      c.present[e] = true;
+    }
+    // nr, time_enabled, time_running, then one value per event
+    std::vector<uint64_t> buf(3 + NumPerfEvents);
+    for (const Group &g : groups) {
+      const ssize_t want = (3 + g.fds.size()) * sizeof(uint64_t);
+      if (read(g.fds[0], buf.data(), want) != want || buf[2] == 0) {
+        continue;
+      }
+      const double scale = double(buf[1]) / buf[2];
+      for (size_t i = 0; i < g.fds.size(); i++) {
+        c.count[events[i]] += buf[3 + i] * scale;
+      }
+    }
+    return c;
+  }
+
+private:
+  struct Group {
+    std::vector<int> fds; // leader first, in the order of `events`
+  };
+
+  std::vector<Group> groups;
+  std::vector<int> events;
+  std::string reason;
+
+  bool has_event(int e) const {
+    for (int x : events) {
+      if (x == e) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static std::vector<pid_t> threads() {
+    std::vector<pid_t> tids;
+    if (DIR *d = opendir("/proc/self/task")) {
+      while (struct dirent *ent = readdir(d)) {
+        if (ent->d_name[0] != '.') {
+          tids.push_back(atoi(ent->d_name));
+        }
+      }
+      closedir(d);
+    }
+    return tids;
+  }
+
+  static int open_event(int e, pid_t tid, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = group_fd < 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    const uint64_t read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    switch (e) {
+    case Cycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case Instructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case L1DMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | read_miss;
+      break;
+    case LLCMisses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case BranchMisses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case DTLBMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_DTLB | read_miss;
+      break;
+    }
+    return syscall(__NR_perf_event_open, &attr, tid, -1, group_fd, 0);
+  }
+
+  static void close_group(Group &g) {
+    for (int fd : g.fds) {
+      close(fd);
+    }
+    g.fds.clear();
+  }
+
+  void close_all() {
+    for (Group &g : groups) {
+      close_group(g);
+    }
+    groups.clear();
+    events.clear();
+  }
+};
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,681 @@
+#ifndef COMMON_PIPELINE_RUNNER_H
+#define COMMON_PIPELINE_RUNNER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Halide.h"
+#include "app_target.h"
+#include "arena_allocator.h"
+#include "autoscheduler.h"
+#include "bench_harness.h"
+#include "boundary.h"
+#include "image_io.h"
+#include "object_cache.h"
+#include "padded_buffer.h"
+#include "perf_counters.h"
+#include "roofline.h"
+#include "schedule_cache.h"
+#include "stage_profiler.h"
+#include "task_tracer.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Schedules, compiles and realizes the output Funcs of an app over a region
+// of the output buffers. The region is produced either in one piece, or as an
+// interior realized by an unguarded copy of the pipeline plus the border
+// strips around it realized by the guarded one.
+//
+// Each pipeline carries a specialization for regions that start on a vector
+// boundary and span whole vectors, so they run without tail iterations; the
+// runner counts how many realizations took it.
+//
+// Host allocations of the pipelines go through the ArenaAllocator, and the
+// runner keeps per-call allocation and page fault counts. It reads the
+// counters, which takes the arena lock and a getrusage call, before its
+// first realization and in describe(), not around every timed call, so
+// the counts also cover what the benchmark does between calls.
+//
+// Pipelines are autoscheduled unless the app scheduled them by hand. Auto
+// schedules are cached on disk, keyed by the pipeline, target and estimates,
+// and reapplied instead of re-running the autoscheduler. Key and schedule
+// use canonical names for the Funcs and Vars Halide named, so that they
+// match in any run that builds the same pipeline. On CPU targets the
+// compiled pipelines are cached too, as shared objects loaded with dlopen.
+//
+// With --profile=on the pipelines are JIT compiled with the Halide profiler,
+// and write_profile() reports time, threads and memory per Func as JSON.
+//
+// With --perf=on each realization is bracketed by reads of hardware counters
+// on every thread of the process, and describe() adds the events per call.
+// The counters are opened after the first realization, once the Halide
+// thread pool exists, so it serves as their warmup. They count host work
+// only: on GPU targets that is launching kernels and copying buffers.
+//
+// With --roofline=on report_roofline() sets the work and compulsory traffic
+// derived from the Func graph against the measured limits of the device.
+//
+// With --trace=on the second realization, after the one that starts the
+// thread pool, is recorded task by task and written as a Chrome trace to
+// <trace_dir()>/<app>-<auto|manual>-<whole|split>.json.
+//
+// With --startup=on|only the first realization reports how long each step
+// to it took: building the Func graph (timed by the app), scheduling,
+// lowering, LLVM codegen, and the first call with its bounds queries and
+// allocations. Lowering is timed by lowering the pipeline once more before
+// JIT compiling it, and codegen is the rest of the JIT compile.
+//
+// With --output=DIR write_outputs() stores the outputs of the last call to
+// DIR/<app>-<auto|manual>-<whole|split>[-<kind>].<format>, where the kind
+// is that of a generated input. With --input or --output it reports the
+// load, compute and store times apart.
+//
+// make_copies() provides copies of the pipelines that threads can realize
+// concurrently with realize_copy(), each into its own outputs, with their
+// parallel loops sent to a hook of the caller's instead of the Halide
+// thread pool, or to the pool of the pipelines without a hook. Copies are
+// not counted, profiled or traced.
+class PipelineRunner {
+public:
+  PipelineRunner(const AppOptions &opts, const Target &target,
+                 const std::vector<Func> &outputs, const Rect &region)
+      : opts(opts), target(target), outputs(outputs), region(region) {
+    if (opts.profile) {
+      this->target = target.with_feature(Target::Profile);
+      StageProfiler::instance().reset();
+    }
+    for (const Func &f : outputs) {
+      lanes = std::max(lanes, natural_lanes(target, f.output_types()[0]));
+    }
+    ArenaAllocator::instance().configure(opts.arena != "off",
+                                         opts.arena == "thp");
+  }
+
+  // Produce `interior` with `unguarded`, which must only read inside the
+  // input there. An empty interior leaves the runner unsplit.
+  void split(const std::vector<Func> &unguarded, const Rect &interior) {
+    if (interior.empty()) {
+      return;
+    }
+    // Shrink the interior to whole vectors so it takes the fast path; the
+    // left and right strips absorb the rest.
+    Rect aligned = align_x(interior);
+    interior_outputs = unguarded;
+    interior_region = aligned.empty() ? interior : aligned;
+    strips = border_strips(region, interior_region);
+  }
+
+  bool is_split() const { return !interior_outputs.empty(); }
+
+  // The region of the outputs the runner produces
+  const Rect &output_rect() const { return region; }
+
+  // Keep the schedule the app gave the outputs instead of autoscheduling
+  void use_manual_schedule() { manual = true; }
+
+  const char *schedule_label() const {
+    return manual ? "Manual" : "Auto-tuned";
+  }
+
+  // Time the app took to build the Func graph of the outputs
+  void set_build_ms(double ms) { startup.build_ms = ms; }
+
+  void compile() {
+    auto start = std::chrono::steady_clock::now();
+    guarded = schedule(outputs, region);
+    if (is_split()) {
+      unguarded = schedule(interior_outputs, interior_region);
+    }
+    printf("Compiled in %.2fms (%s)\n", ms_since(start),
+           compile_mode.c_str());
+  }
+
+  void realize(std::vector<Buffer<>> outs) {
+    if (calls == 0) {
+      alloc_start = ArenaAllocator::instance().stats();
+    }
+    const bool count = open_counters();
+    const PerfCounts start = count ? perf.read_counts() : PerfCounts();
+    const bool trace = opts.trace && calls == 1;
+    if (trace) {
+      TaskTracer::instance().start();
+    }
+    auto realize_start = std::chrono::steady_clock::now();
+    realize_region(guarded, unguarded, outs, true);
+    if (calls == 0) {
+      startup.first_realize_ms = ms_since(realize_start);
+      report_startup();
+    }
+    if (trace) {
+      TaskTracer::instance().stop();
+      write_trace();
+    }
+    if (count) {
+      perf_totals = perf_totals + (perf.read_counts() - start);
+      perf_calls++;
+    }
+    calls++;
+  }
+
+  // Provide at least `n` copies of the pipelines for realize_copy(), whose
+  // parallel loops go to `do_par_for` until drop_copies(), or to the Halide
+  // thread pool if it is null. All copies share one hook. Cached objects
+  // are reentrant and shared by the copies; JIT pipelines are compiled
+  // again for each, from the schedules already on their Funcs.
+  void make_copies(int n, halide_do_par_for_t do_par_for) {
+    if (copies.empty()) {
+      hook_object(guarded, do_par_for);
+      hook_object(unguarded, do_par_for);
+    }
+    while ((int)copies.size() < n) {
+      Copy c;
+      c.guarded = copy_of(guarded, outputs, do_par_for);
+      if (is_split()) {
+        c.unguarded = copy_of(unguarded, interior_outputs, do_par_for);
+      }
+      copies.push_back(c);
+    }
+  }
+
+  // Send the parallel loops of the runner's own pipelines to `do_par_for`,
+  // or back to the Halide thread pool if it is null
+  void set_do_par_for(halide_do_par_for_t do_par_for) {
+    for (CompiledPipeline *c : {&guarded, &unguarded}) {
+      if (c->object) {
+        ObjectPipeline *o = c->object.get();
+        auto def = object_defaults.find(o);
+        if (do_par_for) {
+          const halide_do_par_for_t previous = o->set_do_par_for(do_par_for);
+          if (previous && def == object_defaults.end()) {
+            object_defaults[o] = previous;
+          }
+        } else if (def != object_defaults.end()) {
+          o->set_do_par_for(def->second);
+        }
+      } else if (c->pipeline.defined()) {
+        c->pipeline.set_custom_do_par_for(do_par_for);
+      }
+    }
+  }
+
+  // Realize copy `i` into `outs`; copies may run concurrently on different
+  // threads
+  void realize_copy(int i, std::vector<Buffer<>> outs) {
+    realize_region(copies[i].guarded, copies[i].unguarded, outs, false);
+  }
+
+  // Release the copies and restore the parallel loops of cached objects
+  void drop_copies() {
+    for (auto &it : object_hooks) {
+      it.first->set_do_par_for(it.second);
+    }
+    object_hooks.clear();
+    copies.clear();
+  }
+
+  std::string describe() const {
+    std::string s = std::to_string(region.width) + "x" +
+                    std::to_string(region.height);
+    if (is_split()) {
+      s += ", interior " + std::to_string(interior_region.width) + "x" +
+           std::to_string(interior_region.height) + " + " +
+           std::to_string(strips.size()) + " border strips";
+    }
+    s += ", fast path " + std::to_string(fast_realizations) + "/" +
+         std::to_string(fast_realizations + generic_realizations);
+    if (opts.profile) {
+      s += ", profiled";
+    }
+    if (calls > 0) {
+      const AllocStats alloc_totals =
+          ArenaAllocator::instance().stats() - alloc_start;
+      char buf[128];
+      snprintf(buf, sizeof(buf),
+               ", %.1f allocs (%.1f fresh) %.2f MB %.1f faults per call",
+               double(alloc_totals.allocations) / calls,
+               double(alloc_totals.fresh) / calls,
+               double(alloc_totals.bytes) / calls / (1 << 20),
+               double(alloc_totals.page_faults) / calls);
+      s += buf;
+    }
+    if (perf_calls > 0) {
+      s += ", " + perf_totals.describe(perf_calls);
+    }
+    return s;
+  }
+
+  // Write the profile of the realizations so far to
+  // <profile_dir()>/<app>-<auto|manual>-<whole|split>.json, where the app is
+  // named after the directory it runs in
+  void write_profile(double best_ms) {
+    if (!opts.profile) {
+      return;
+    }
+    StageProfiler &profiler = StageProfiler::instance();
+    profiler.collect();
+    const std::string path = report_path(profile_dir());
+    if (path.empty()) {
+      return;
+    }
+    const std::map<std::string, std::string> fields = {
+        {"app", StageProfiler::quote(app_name())},
+        {"schedule", StageProfiler::quote(schedule_label())},
+        {"target", StageProfiler::quote(target.to_string())},
+        {"region", StageProfiler::quote(std::to_string(region.width) + "x" +
+                                        std::to_string(region.height))},
+        {"split", is_split() ? "true" : "false"},
+        {"realizations", std::to_string(calls)},
+        {"benchmark_ms", std::to_string(best_ms)}};
+    std::ofstream out(path);
+    out << profiler.json(fields);
+    printf("Profile written to %s\n", path.c_str());
+  }
+
+  // Achieved throughput of a run of the whole region that took `best_ms`,
+  // against the bandwidth and peak FLOPS of the device
+  void report_roofline(double best_ms) const {
+    if (!opts.roofline) {
+      return;
+    }
+    const Target device = target.without_feature(Target::Profile);
+    HalideApps::report_roofline(estimate_work(outputs),
+                                int64_t(region.width) * region.height,
+                                best_ms, machine_limits(device));
+  }
+
+  // Store `outs` as --output asks, and report the time to load the inputs,
+  // to compute one call (`best_ms`) and to store the outputs
+  void write_outputs(std::vector<Buffer<>> outs, double best_ms) {
+    if (opts.inputs.empty() && opts.output.empty()) {
+      return;
+    }
+    double store_ms = 0;
+    int stored = 0;
+    if (!opts.output.empty()) {
+      ScopeTimer timer(store_ms);
+      const std::string kind = input_stats().kind;
+      for (size_t i = 0; i < outs.size(); i++) {
+        const std::string path = output_path(
+            (kind.empty() ? "" : "-" + kind) +
+            (outs.size() > 1 ? "-" + std::to_string(i) : ""));
+        outs[i].copy_to_host();
+        if (!path.empty() && save_output(outs[i], path, opts.output_format)) {
+          stored++;
+        } else {
+          printf("Cannot write %s\n", path.c_str());
+        }
+      }
+    }
+    const InputStats &in = input_stats();
+    char load[64] = "none (generated input)";
+    if (in.loaded > 0) {
+      snprintf(load, sizeof(load), "%.2fms (%s)", in.load_ms,
+               in.mapped ? "memory-mapped" : "decoded");
+    }
+    printf("I/O: load %s, compute %.4gms per call, store %.2fms (%d output%s "
+           "to %s)\n",
+           load, best_ms, store_ms, stored, stored == 1 ? "" : "s",
+           opts.output.empty() ? "nowhere" : opts.output.c_str());
+  }
+
+  // <opts.output>/<app>-<auto|manual>-<whole|split><suffix>.<format>,
+  // creating the directory; empty if it cannot be created
+  std::string output_path(const std::string &suffix) const {
+    return report_path(opts.output, suffix + "." + opts.output_format);
+  }
+
+private:
+  // The app, named after the directory it runs in
+  static std::string app_name() {
+    char cwd[4096];
+    std::string app = getcwd(cwd, sizeof(cwd)) ? cwd : "app";
+    return app.substr(app.rfind('/') + 1);
+  }
+
+  // <dir>/<app>-<auto|manual>-<whole|split><ext>, creating `dir`; empty if
+  // it cannot be created
+  std::string report_path(const std::string &dir,
+                          const std::string &ext = ".json") const {
+    if (!make_dirs(dir)) {
+      return "";
+    }
+    return dir + "/" + app_name() + "-" + (manual ? "manual" : "auto") + "-" +
+           (is_split() ? "split" : "whole") + ext;
+  }
+
+  void write_trace() const {
+    const std::string path = report_path(trace_dir());
+    TaskTracer &tracer = TaskTracer::instance();
+    const std::map<std::string, std::string> fields = {
+        {"app", StageProfiler::quote(app_name())},
+        {"schedule", StageProfiler::quote(schedule_label())},
+        {"target", StageProfiler::quote(target.to_string())},
+        {"region", StageProfiler::quote(std::to_string(region.width) + "x" +
+                                        std::to_string(region.height))}};
+    if (!path.empty() && tracer.write(path, fields)) {
+      printf("Trace of %zu tasks written to %s\n", tracer.tasks(),
+             path.c_str());
+    }
+  }
+
+  AppOptions opts;
+  Target target;
+  std::vector<Func> outputs, interior_outputs;
+  Rect region, interior_region = {0, 0, 0, 0};
+  std::vector<Rect> strips;
+  // A scheduled pipeline, JIT compiled or loaded from the object cache
+  struct CompiledPipeline {
+    Pipeline pipeline;
+    std::shared_ptr<ObjectPipeline> object;
+
+    void realize(std::vector<Buffer<>> &outs) {
+      if (object) {
+        const int rc = object->realize(outs);
+        if (rc != 0) {
+          throw RuntimeError("Cached pipeline object failed with error " +
+                             std::to_string(rc));
+        }
+      } else {
+        Realization dst(outs);
+        pipeline.realize(dst);
+      }
+    }
+  };
+
+  CompiledPipeline guarded, unguarded;
+  // Copies for concurrent realizations, and the hooks the parallel loops of
+  // the cached objects they share went to before
+  struct Copy {
+    CompiledPipeline guarded, unguarded;
+  };
+  std::vector<Copy> copies;
+  std::vector<std::pair<std::shared_ptr<ObjectPipeline>, halide_do_par_for_t>>
+      object_hooks;
+  // The hooks of cached objects before set_do_par_for() first changed them
+  std::map<ObjectPipeline *, halide_do_par_for_t> object_defaults;
+  std::string compile_mode = "JIT";
+  bool manual = false;
+  int lanes = 1;
+  int fast_realizations = 0, generic_realizations = 0;
+  // Arena counters before the first realization
+  AllocStats alloc_start;
+  int calls = 0;
+
+  // Time to the first realization, by step
+  struct StartupTimes {
+    double build_ms = 0, schedule_ms = 0, lower_ms = 0, codegen_ms = 0,
+           first_realize_ms = 0;
+  } startup;
+
+  void report_startup() const {
+    if (opts.startup == "off") {
+      return;
+    }
+    const StartupTimes &t = startup;
+    const bool jit = compile_mode == "JIT";
+    printf("Startup: build %.2fms, schedule %.2fms, %s %.2fms, %s %.2fms, "
+           "first realize %.2fms; %.2fms to the first frame\n",
+           t.build_ms, t.schedule_ms, jit ? "lower" : "lower for cache key",
+           t.lower_ms, jit ? "codegen" : compile_mode.c_str(), t.codegen_ms,
+           t.first_realize_ms,
+           t.build_ms + t.schedule_ms + t.lower_ms + t.codegen_ms +
+               t.first_realize_ms);
+  }
+  PerfCounters perf;
+  PerfCounts perf_totals;
+  int perf_calls = 0;
+  bool perf_failed = false;
+
+  bool open_counters() {
+    if (!opts.perf || perf_failed || perf.is_open() || calls == 0) {
+      return perf.is_open();
+    }
+    if (!perf.open()) {
+      printf("Hardware counters unavailable: %s\n", perf.error().c_str());
+      perf_failed = true;
+    }
+    return perf.is_open();
+  }
+
+  // Must match the specialization added in schedule(), whose % is
+  // Halide's Euclidean one, so regions with a negative x count right
+  bool is_fast(const Rect &r) const {
+    return ((r.x % lanes) + lanes) % lanes == 0 && r.width % lanes == 0;
+  }
+
+  void count_path(const Rect &r) {
+    if (is_fast(r)) {
+      fast_realizations++;
+    } else {
+      generic_realizations++;
+    }
+  }
+
+  // The whole vectors of `r` along x
+  Rect align_x(const Rect &r) const {
+    auto floor_to = [&](int v) { return v - ((v % lanes) + lanes) % lanes; };
+    const int x0 = floor_to(r.x + lanes - 1);
+    const int x1 = floor_to(r.x + r.width);
+    return {x0, r.y, x1 - x0, r.height};
+  }
+
+  CompiledPipeline schedule(std::vector<Func> funcs, const Rect &r) {
+    for (Func &f : funcs) {
+      std::vector<Var> args = f.args();
+      f.set_estimate(args[0], r.x, r.width).set_estimate(args[1], r.y, r.height);
+    }
+    Pipeline p(funcs);
+    p.set_custom_allocator(ArenaAllocator::halide_malloc,
+                           ArenaAllocator::halide_free);
+    if (opts.profile) {
+      p.set_custom_print(StageProfiler::halide_print);
+    }
+    if (opts.trace) {
+      p.set_custom_do_task(TaskTracer::halide_do_task);
+    }
+    auto start = std::chrono::steady_clock::now();
+    if (manual) {
+      printf("Scheduled by hand\n");
+    } else {
+      auto_schedule(p, funcs, r);
+    }
+    if (opts.pad) {
+      align_intermediates(funcs);
+    }
+    // The specialization inherits the schedule just applied; within it the
+    // simplifier knows the loop bounds are vector aligned and drops the tail
+    // and unaligned loads. Other regions fall through to the generic code.
+    for (Func &f : funcs) {
+      OutputImageParam o = f.output_buffer();
+      f.specialize(o.dim(0).min() % lanes == 0 &&
+                   o.dim(0).extent() % lanes == 0);
+    }
+    startup.schedule_ms += ms_since(start);
+    CompiledPipeline c = {p, nullptr};
+    // The profiler and the tracer hook into the JIT runtime
+    if (opts.object_cache && !opts.profile && !opts.trace &&
+        ObjectPipeline::supported(target)) {
+      auto object = std::make_shared<ObjectPipeline>();
+      bool hit = false;
+      start = std::chrono::steady_clock::now();
+      if (object->load(p, funcs, target, hit)) {
+        c.object = object;
+        compile_mode = hit ? "object cache hit" : "object cache miss";
+        // The key is the lowered pipeline, so a hit still lowers it
+        const double key_ms = object->key_ms();
+        startup.lower_ms += key_ms;
+        startup.codegen_ms += std::max(0.0, ms_since(start) - key_ms);
+        return c;
+      }
+    }
+    double lower_ms = 0;
+    if (opts.startup != "off") {
+      start = std::chrono::steady_clock::now();
+      p.compile_to_module(p.infer_arguments(), "startup_lowering", target);
+      lower_ms = ms_since(start);
+      startup.lower_ms += lower_ms;
+    }
+    start = std::chrono::steady_clock::now();
+    p.compile_jit(target);
+    // compile_jit lowers again before codegen
+    startup.codegen_ms += std::max(0.0, ms_since(start) - lower_ms);
+    return c;
+  }
+
+  // One line per scheduled pipeline; scripts/compare_autoschedulers.sh
+  // parses it
+  void report_schedule(const std::string &how, double ms) {
+    printf("Scheduled with %s (%s)%s in %.2fms\n",
+           opts.autoscheduler.empty() ? "default autoscheduler"
+                                      : opts.autoscheduler.c_str(),
+           opts.machine_params.empty() ? "generic machine"
+                                       : opts.machine_params.c_str(),
+           how.empty() ? "" : (", " + how).c_str(), ms);
+  }
+
+  // Apply the cached schedule of this pipeline if there is one, otherwise
+  // run the autoscheduler and cache its choice.
+  void auto_schedule(Pipeline &p, const std::vector<Func> &funcs,
+                     const Rect &r) {
+    auto start = std::chrono::steady_clock::now();
+    if (opts.schedule_cache == "off") {
+      run_autoscheduler(p, target, opts);
+      report_schedule("", ms_since(start));
+      return;
+    }
+    const std::string estimates =
+        std::to_string(r.x) + "," + std::to_string(r.y) + "," +
+        std::to_string(r.width) + "x" + std::to_string(r.height);
+    const std::string key =
+        pipeline_hash(funcs) + "-" +
+        fnv1a(target.to_string() + " " + estimates + " " +
+              opts.autoscheduler + " " + opts.machine_params);
+    CachedSchedule cached;
+    const bool hit = load_schedule(key, cached);
+    if (hit && opts.schedule_cache == "on" &&
+        apply_schedule(funcs, cached.text)) {
+      const double apply_ms = ms_since(start);
+      report_schedule("cache hit " + key, apply_ms);
+      printf("Schedule cache saved %.2fms\n",
+             cached.auto_schedule_ms - apply_ms);
+      return;
+    }
+    run_autoscheduler(p, target, opts);
+    CachedSchedule fresh = {serialize_schedule(funcs), ms_since(start)};
+    report_schedule("cache miss " + key, fresh.auto_schedule_ms);
+    if (hit && fresh.text != cached.text) {
+      printf("Schedule changed since it was cached:\n");
+      print_schedule_diff(cached.text, fresh.text);
+    }
+    if (!fresh.text.empty()) {
+      store_schedule(key, fresh);
+    }
+  }
+
+  void hook_object(CompiledPipeline &c, halide_do_par_for_t do_par_for) {
+    if (c.object && do_par_for) {
+      halide_do_par_for_t previous = c.object->set_do_par_for(do_par_for);
+      if (previous) {
+        object_hooks.push_back({c.object, previous});
+      }
+    }
+  }
+
+  CompiledPipeline copy_of(const CompiledPipeline &c,
+                           const std::vector<Func> &funcs,
+                           halide_do_par_for_t do_par_for) {
+    if (c.object) {
+      return c;
+    }
+    Pipeline p(funcs);
+    p.set_custom_allocator(ArenaAllocator::halide_malloc,
+                           ArenaAllocator::halide_free);
+    if (do_par_for) {
+      p.set_custom_do_par_for(do_par_for);
+    }
+    p.compile_jit(target);
+    return {p, nullptr};
+  }
+
+  // Realize the region into `outs` with `whole_or_guarded`, and
+  // `interior` when split. `counted` realizations are the runner's own;
+  // they count fast paths and mark pieces for the profiler and the tracer.
+  void realize_region(CompiledPipeline &whole_or_guarded,
+                      CompiledPipeline &interior, std::vector<Buffer<>> &outs,
+                      bool counted) {
+    if (!is_split() && buffer_rect(outs[0]) == region) {
+      if (counted) {
+        count_path(region);
+        begin_piece("whole");
+      }
+      whole_or_guarded.realize(outs);
+      return;
+    }
+
+    // Crops of a device allocation share it, so allocate the whole output
+    // first and mark it dirty once all pieces are written.
+    const bool gpu = target.has_gpu_feature();
+    if (gpu) {
+      for (Buffer<> &b : outs) {
+        if (!b.has_device_allocation()) {
+          b.device_malloc(target);
+        }
+      }
+    }
+    if (is_split()) {
+      begin_piece("interior", counted);
+      realize_rect(interior, outs, interior_region, counted);
+      begin_piece("border", counted);
+      for (const Rect &s : strips) {
+        realize_rect(whole_or_guarded, outs, s, counted);
+      }
+    } else {
+      begin_piece("whole", counted);
+      realize_rect(whole_or_guarded, outs, region, counted);
+    }
+    if (gpu) {
+      for (Buffer<> &b : outs) {
+        b.set_device_dirty();
+      }
+    }
+  }
+
+  // Attribute what runs next to `label` in profiles and traces
+  void begin_piece(const std::string &label, bool counted = true) {
+    if (!counted) {
+      return;
+    }
+    if (opts.profile) {
+      StageProfiler::instance().begin(label);
+    }
+    TaskTracer::instance().mark(label);
+  }
+
+  void realize_rect(CompiledPipeline &p, std::vector<Buffer<>> &outs,
+                    const Rect &r, bool counted) {
+    std::vector<Buffer<>> crops;
+    for (Buffer<> &b : outs) {
+      crops.push_back(b.cropped({{r.x, r.width}, {r.y, r.height}}));
+    }
+    if (counted) {
+      count_path(r);
+    }
+    p.realize(crops);
+  }
+};
+
+} // namespace HalideApps
+
+#endif
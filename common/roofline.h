@@ -0,0 +1,212 @@
+#ifndef COMMON_ROOFLINE_H
+#define COMMON_ROOFLINE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "app_target.h"
+#include "halide_benchmark.h"
+#include "object_cache.h"
+#include "schedule_cache.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Counts the arithmetic of an expression: each add, subtract, multiply,
+// divide, modulo, min, max and select counts one, as does each call to a
+// math function such as exp or sqrt. Shared subexpressions count once, as
+// after CSE, and the coordinates of calls to Funcs and images count nothing.
+class CountOps : public Internal::IRGraphVisitor {
+public:
+  int64_t ops = 0;
+
+protected:
+  using Internal::IRGraphVisitor::visit;
+
+  void visit(const Internal::Add *op) override { count(op); }
+  void visit(const Internal::Sub *op) override { count(op); }
+  void visit(const Internal::Mul *op) override { count(op); }
+  void visit(const Internal::Div *op) override { count(op); }
+  void visit(const Internal::Mod *op) override { count(op); }
+  void visit(const Internal::Min *op) override { count(op); }
+  void visit(const Internal::Max *op) override { count(op); }
+  void visit(const Internal::Select *op) override { count(op); }
+
+  void visit(const Internal::Call *op) override {
+    if (op->call_type == Internal::Call::Halide ||
+        op->call_type == Internal::Call::Image) {
+      return;
+    }
+    if (op->call_type == Internal::Call::PureExtern) {
+      ops++;
+    }
+    Internal::IRGraphVisitor::visit(op);
+  }
+
+private:
+  template <typename T> void count(const T *op) {
+    ops++;
+    Internal::IRGraphVisitor::visit(op);
+  }
+};
+
+// Work of a pipeline per output pixel and the memory traffic it cannot
+// avoid: reading every input once and writing every output once
+struct WorkEstimate {
+  double ops_per_pixel = 0;
+  double input_bytes = 0;
+  double output_bytes_per_pixel = 0;
+
+  double ops(int64_t pixels) const { return ops_per_pixel * pixels; }
+
+  double bytes(int64_t pixels) const {
+    return input_bytes + output_bytes_per_pixel * pixels;
+  }
+};
+
+// Derive the WorkEstimate of a pipeline from its Func graph. Every Func is
+// taken to be computed once per output pixel, and each update once per
+// point of its reduction domain; this overstates the work of pipelines
+// whose intermediates are smaller than their outputs, like pyramids.
+inline WorkEstimate estimate_work(const std::vector<Func> &outputs) {
+  WorkEstimate w;
+  for (auto &it : pipeline_functions(outputs)) {
+    const Internal::Function &fn = it.second;
+    std::vector<Internal::Definition> defs = {fn.definition()};
+    defs.insert(defs.end(), fn.updates().begin(), fn.updates().end());
+    for (const Internal::Definition &d : defs) {
+      CountOps count;
+      for (const Expr &e : d.values()) {
+        e.accept(&count);
+      }
+      double points = 1;
+      for (const Internal::ReductionVariable &rv : d.schedule().rvars()) {
+        const int64_t *extent =
+            Internal::as_const_int(Internal::simplify(rv.extent));
+        points *= extent ? *extent : 1;
+      }
+      w.ops_per_pixel += count.ops * points;
+    }
+  }
+  FindPipelineInputs inputs;
+  inputs.include_pipeline(outputs);
+  for (auto &it : inputs.buffers) {
+    w.input_bytes += it.second.size_in_bytes();
+  }
+  for (const Func &f : outputs) {
+    for (const Type &t : f.output_types()) {
+      w.output_bytes_per_pixel += t.bytes();
+    }
+  }
+  return w;
+}
+
+// Limits of the device a target runs on, measured with Halide pipelines
+struct MachineLimits {
+  double gb_per_s = 0;    // STREAM triad bandwidth
+  double gflop_per_s = 0; // float multiply-add throughput
+
+  // Arithmetic intensity, in ops per byte, above which the peak is reached
+  double ridge() const { return gflop_per_s / gb_per_s; }
+};
+
+// STREAM triad a(x) + 3 * b(x) over arrays well beyond the last-level
+// cache, counting 12 bytes per element moved as STREAM does
+inline double measure_bandwidth(const Target &target) {
+  const int n = 1 << 24;
+  Buffer<float> a(n), b(n), c(n);
+  a.fill(1.0f);
+  b.fill(2.0f);
+  Var x, xo, xi;
+  Func triad("stream_triad");
+  triad(x) = a(x) + 3.0f * b(x);
+  if (target.has_gpu_feature()) {
+    triad.gpu_tile(x, xo, xi, 256);
+  } else {
+    triad.split(x, xo, xi, 1 << 14)
+        .parallel(xo)
+        .vectorize(xi, target.natural_vector_size<float>());
+  }
+  triad.compile_jit(target);
+  copy_to_device(a, target);
+  copy_to_device(b, target);
+  double best = Tools::benchmark(5, 3, [&]() {
+    triad.realize(c, target);
+    c.device_sync();
+  });
+  return 3.0 * sizeof(float) * n / best / 1e9;
+}
+
+// Chains of dependent multiply-adds, kept in registers: each pixel runs
+// `depth` of them, and each thread runs several pixels at once to cover the
+// latency of the chain. The coefficients are Params so that the simplifier
+// cannot fold the chain.
+inline double measure_peak_flops(const Target &target) {
+  const bool gpu = target.has_gpu_feature();
+  const int n = gpu ? 1 << 24 : 1 << 22;
+  const int depth = 256;
+  Param<float> scale("peak_scale", 0.999f), offset("peak_offset", 0.001f);
+  Var x, xo, xi;
+  Expr e = cast<float>(x);
+  for (int i = 0; i < depth; i++) {
+    e = e * scale + offset;
+  }
+  Func peak("peak_flops");
+  peak(x) = e;
+  if (gpu) {
+    peak.gpu_tile(x, xo, xi, 256);
+  } else {
+    const int lanes = target.natural_vector_size<float>();
+    peak.split(x, xo, xi, lanes * 8).parallel(xo).vectorize(xi);
+  }
+  peak.compile_jit(target);
+  Buffer<float> out(n);
+  double best = Tools::benchmark(5, 3, [&]() {
+    peak.realize(out, target);
+    out.device_sync();
+  });
+  return 2.0 * depth * n / best / 1e9;
+}
+
+// The limits of the device of `target`, measured once per process
+inline const MachineLimits &machine_limits(const Target &target) {
+  static std::map<std::string, MachineLimits> measured;
+  const std::string key = target.to_string();
+  auto it = measured.find(key);
+  if (it != measured.end()) {
+    return it->second;
+  }
+  MachineLimits m;
+  m.gb_per_s = measure_bandwidth(target);
+  m.gflop_per_s = measure_peak_flops(target);
+  printf("Machine limits (%s): STREAM triad %.1f GB/s, peak %.1f GFLOP/s, "
+         "ridge %.2f ops/byte\n",
+         key.c_str(), m.gb_per_s, m.gflop_per_s, m.ridge());
+  return measured[key] = m;
+}
+
+// Place a run of `pixels` output pixels that took `ms` on the roofline
+inline void report_roofline(const WorkEstimate &w, int64_t pixels, double ms,
+                            const MachineLimits &m) {
+  const double ops = w.ops(pixels), bytes = w.bytes(pixels);
+  const double intensity = ops / bytes;
+  const double gops = ops / ms / 1e6, gbs = bytes / ms / 1e6;
+  const double attainable = std::min(m.gflop_per_s, intensity * m.gb_per_s);
+  printf("Roofline: %.1f ops/pixel, %.2f ops/byte, %.2f Gops/s (%.1f%% of "
+         "peak), %.2f GB/s (%.1f%% of STREAM), %s-bound, %.1f%% of "
+         "attainable\n",
+         w.ops_per_pixel, intensity, gops, 100 * gops / m.gflop_per_s, gbs,
+         100 * gbs / m.gb_per_s,
+         intensity < m.ridge() ? "memory" : "compute",
+         100 * gops / attainable);
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef COMMON_RUNTIME_PARAMS_H
+#define COMMON_RUNTIME_PARAMS_H
+
+#include <cstdio>
+#include <string>
+
+#include "Halide.h"
+#include "bench_harness.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// A scalar parameter read at every call, with its default value as the
+// estimate the autoschedulers need
+template <typename T> Param<T> tunable(const std::string &name, T value) {
+  Param<T> p(name, value);
+  p.set_estimate(value);
+  return p;
+}
+
+// An image read through an ImageParam, so that the buffer behind it can be
+// replaced between calls without recompiling. The shape is fixed by the
+// buffer it is made with: the pipeline checks every buffer set later
+// against it, and its bounds stay constant for footprints and schedules.
+template <typename T> class BufferParam {
+public:
+  BufferParam(const std::string &name, const Buffer<T> &image)
+      : image_param(type_of<T>(), 2, name), image(image) {
+    for (int d = 0; d < 2; d++) {
+      const int min = image.dim(d).min(), extent = image.dim(d).extent();
+      image_param.dim(d).set_bounds(min, extent);
+      image_param.dim(d).set_estimate(min, extent);
+    }
+    image_param.set(image);
+  }
+
+  // Read `b`, of the same shape, from the next call on
+  void set(const Buffer<T> &b) {
+    image = b;
+    image_param.set(image);
+  }
+
+  Buffer<T> &buffer() { return image; }
+  const Buffer<T> &buffer() const { return image; }
+  const ImageParam &param() const { return image_param; }
+
+  Expr operator()(Expr x, Expr y) const { return image_param(x, y); }
+
+protected:
+  ImageParam image_param;
+  Buffer<T> image;
+};
+
+// A convolution mask whose weights can change between calls. Its reduction
+// domain has constant bounds, which keeps unrolling and schedules as they
+// were with the mask baked in.
+template <typename T> class MaskParam : public BufferParam<T> {
+public:
+  MaskParam(const std::string &name, const Buffer<T> &mask)
+      : BufferParam<T>(name, mask) {}
+
+  RDom domain() const {
+    const Buffer<T> &mask = this->image;
+    return RDom(mask.dim(0).min(), mask.width(), mask.dim(1).min(),
+                mask.height());
+  }
+};
+
+// Compare a benchmark with fixed parameters to one that changed them before
+// every call, for --param-sweep
+inline void report_param_sweep(const CacheBench &fixed,
+                               const CacheBench &varying) {
+  const double ms = fixed.median_ms();
+  printf("Param sweep: %.4gms per call with the parameters changed before "
+         "every call, %+.2f%% against fixed ones\n",
+         varying.median_ms(),
+         ms > 0 ? 100 * (varying.median_ms() - ms) / ms : 0);
+}
+
+} // namespace HalideApps
+
+#endif
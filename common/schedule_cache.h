@@ -0,0 +1,449 @@
+#ifndef COMMON_SCHEDULE_CACHE_H
+#define COMMON_SCHEDULE_CACHE_H
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Halide.h"
+#include "bench_harness.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// Every Function the outputs depend on, including the outputs, by name
+inline std::map<std::string, Internal::Function>
+pipeline_functions(const std::vector<Func> &outputs) {
+  std::map<std::string, Internal::Function> env;
+  for (const Func &f : outputs) {
+    std::map<std::string, Internal::Function> calls =
+        Internal::find_transitive_calls(f.function());
+    env.insert(calls.begin(), calls.end());
+  }
+  return env;
+}
+
+// 64-bit FNV-1a, stable across compilers and runs
+inline std::string fnv1a(const std::string &s) {
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : s) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  char buf[17];
+  snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+  return buf;
+}
+
+// Names Halide generates for unnamed Funcs, Vars, RDoms, Params and
+// Buffers: a letter and a counter of the objects of that kind built so far
+// in the process. They differ between runs of one pipeline whenever the
+// runs build other objects first.
+inline bool is_generated_name(const std::string &t) {
+  if (t.size() < 2 || std::string("fvrpb").find(t[0]) == std::string::npos) {
+    return false;
+  }
+  return std::all_of(t.begin() + 1, t.end(),
+                     [](char c) { return isdigit((unsigned char)c); });
+}
+
+// `text` with each identifier replaced by `rename(identifier)`. Dots and
+// dollar signs separate the parts of qualified names, such as the loops of
+// a split or the dimensions of an RDom.
+template <typename F>
+std::string map_identifiers(const std::string &text, F rename) {
+  std::string out, token;
+  for (char c : text) {
+    if (isalnum((unsigned char)c) || c == '_') {
+      token += c;
+      continue;
+    }
+    if (!token.empty()) {
+      out += rename(token);
+      token.clear();
+    }
+    out += c;
+  }
+  return token.empty() ? out : out + rename(token);
+}
+
+// Stable names for the generated names of a pipeline: each is replaced by
+// its letter, an underscore and the count of generated names of that
+// letter seen before it, in the order the pipeline text names them, so
+// that f27 may become f_0. Explicit names are kept.
+class CanonicalNames {
+public:
+  // `text` with its generated names canonical, numbering new ones
+  std::string canonical(const std::string &text) {
+    return map_identifiers(text, [&](const std::string &t) -> std::string {
+      if (!is_generated_name(t)) {
+        return t;
+      }
+      auto it = to_canonical.find(t);
+      if (it != to_canonical.end()) {
+        return it->second;
+      }
+      const std::string c =
+          t.substr(0, 1) + "_" + std::to_string(counts[t[0]]++);
+      to_canonical[t] = c;
+      to_actual[c] = t;
+      return c;
+    });
+  }
+
+  // `text` with canonical names back to the names of this pipeline. Those
+  // it does not have, such as the loops a schedule adds, stay canonical.
+  std::string actual(const std::string &text) const {
+    return map_identifiers(text, [&](const std::string &t) -> std::string {
+      auto it = to_actual.find(t);
+      return it == to_actual.end() ? t : it->second;
+    });
+  }
+
+private:
+  std::map<std::string, std::string> to_canonical, to_actual;
+  std::map<char, int> counts;
+};
+
+// The definitions of `fn` and its updates, one line each
+inline std::string definition_text(const Internal::Function &fn) {
+  std::ostringstream s;
+  std::vector<Internal::Definition> defs = {fn.definition()};
+  defs.insert(defs.end(), fn.updates().begin(), fn.updates().end());
+  for (const Internal::Definition &d : defs) {
+    for (const Expr &e : d.args()) {
+      s << " " << e;
+    }
+    s << " =";
+    for (const Expr &e : d.values()) {
+      s << " " << e;
+    }
+    s << "\n";
+  }
+  return s.str();
+}
+
+// The Functions of the pipeline in an order that does not depend on their
+// names: the outputs, then breadth first the Functions each one calls, in
+// the order its definitions name them
+inline std::vector<Internal::Function>
+ordered_functions(const std::vector<Func> &outputs) {
+  std::map<std::string, Internal::Function> env = pipeline_functions(outputs);
+  std::vector<Internal::Function> order;
+  std::set<std::string> seen;
+  for (const Func &f : outputs) {
+    if (seen.insert(f.name()).second) {
+      order.push_back(f.function());
+    }
+  }
+  for (size_t i = 0; i < order.size(); i++) {
+    map_identifiers(definition_text(order[i]), [&](const std::string &t) {
+      if (env.count(t) && seen.insert(t).second) {
+        order.push_back(env[t]);
+      }
+      return t;
+    });
+  }
+  return order;
+}
+
+// Canonical names of the pipeline, numbered by walking its definitions from
+// the outputs; `text`, if given, receives the canonical form of those
+inline CanonicalNames pipeline_names(const std::vector<Func> &outputs,
+                                     std::string *text = nullptr) {
+  CanonicalNames names;
+  std::ostringstream s;
+  for (const Func &f : outputs) {
+    s << "output " << f.name() << "\n";
+  }
+  for (const Internal::Function &fn : ordered_functions(outputs)) {
+    s << "func " << fn.name();
+    for (const std::string &a : fn.args()) {
+      s << " " << a;
+    }
+    s << "\n" << definition_text(fn);
+  }
+  const std::string canonical = names.canonical(s.str());
+  if (text) {
+    *text = canonical;
+  }
+  return names;
+}
+
+// Hash of the algorithm of the pipeline: the definitions of all its Funcs,
+// with canonical names, so that it is the same in every run that builds
+// the pipeline. Masks enter through their names and the extents of the
+// RDoms over them.
+inline std::string pipeline_hash(const std::vector<Func> &outputs) {
+  std::string text;
+  pipeline_names(outputs, &text);
+  return fnv1a(text);
+}
+
+inline std::string loop_level_string(LoopLevel level) {
+  level.lock();
+  if (level.is_inlined()) {
+    return "inline";
+  } else if (level.is_root()) {
+    return "root";
+  }
+  return level.func() + " " + level.var().name() + " " +
+         std::to_string(level.var().is_rvar) + " " +
+         std::to_string(level.stage_index());
+}
+
+inline std::string expr_string(const Expr &e) {
+  if (!e.defined()) {
+    return "-";
+  }
+  const int64_t *i = Internal::as_const_int(e);
+  return i ? std::to_string(*i) : "?";
+}
+
+// Text form of the schedule of every Func of the pipeline, one directive
+// per line so that two schedules can be diffed, with the canonical names
+// of pipeline_names(). Returns an empty string if the schedule uses a
+// non-constant split factor or alignment, which this form cannot hold.
+inline std::string serialize_schedule(const std::vector<Func> &outputs) {
+  CanonicalNames names = pipeline_names(outputs);
+  std::ostringstream s;
+  for (const Internal::Function &fn : ordered_functions(outputs)) {
+    const Internal::FuncSchedule &fs = fn.schedule();
+    s << "func " << fn.name() << "\n";
+    s << "compute " << loop_level_string(fs.compute_level()) << "\n";
+    s << "store " << loop_level_string(fs.store_level()) << "\n";
+    s << "memory " << (int)fs.memory_type() << "\n";
+    for (const Internal::StorageDim &d : fs.storage_dims()) {
+      s << "storage " << d.var << " " << expr_string(d.alignment) << " "
+        << expr_string(d.fold_factor) << " " << d.fold_forward << "\n";
+    }
+    for (int stage = 0; stage <= (int)fn.updates().size(); stage++) {
+      const Internal::StageSchedule &ss =
+          stage == 0 ? fn.definition().schedule()
+                     : fn.updates()[stage - 1].schedule();
+      s << "stage " << stage << "\n";
+      for (const Internal::Split &sp : ss.splits()) {
+        s << "split " << sp.old_var << " " << sp.outer << " " << sp.inner
+          << " " << expr_string(sp.factor) << " " << sp.exact << " "
+          << (int)sp.tail << " " << (int)sp.split_type << "\n";
+      }
+      for (const Internal::Dim &d : ss.dims()) {
+        s << "dim " << d.var << " " << (int)d.for_type << " "
+          << (int)d.device_api << " " << (int)d.dim_type << "\n";
+      }
+    }
+  }
+  std::string text = s.str();
+  return text.find('?') == std::string::npos ? names.canonical(text) : "";
+}
+
+// The schedule of one Func as read back from serialize_schedule() text
+struct FuncScheduleRecord {
+  std::string name;
+  LoopLevel compute, store;
+  MemoryType memory = MemoryType::Auto;
+  std::vector<Internal::StorageDim> storage;
+  std::vector<Internal::StageSchedule> stages;
+};
+
+// Apply a schedule produced by serialize_schedule() to the pipeline. The
+// pipeline is left untouched, and false returned, if the text names a Func,
+// stage or loop level the pipeline does not have.
+inline bool apply_schedule(const std::vector<Func> &outputs,
+                           const std::string &canonical_text) {
+  const std::string text = pipeline_names(outputs).actual(canonical_text);
+  std::map<std::string, Internal::Function> env = pipeline_functions(outputs);
+  auto parse_expr = [](const std::string &t) {
+    return t == "-" ? Expr() : Expr(atoi(t.c_str()));
+  };
+  auto parse_level = [&](std::istringstream &in, LoopLevel &level) {
+    std::string func, var;
+    int is_rvar, stage;
+    in >> func;
+    if (func == "inline") {
+      level = LoopLevel::inlined();
+    } else if (func == "root") {
+      level = LoopLevel::root();
+    } else if (in >> var >> is_rvar >> stage && env.count(func)) {
+      level = LoopLevel(env[func], VarOrRVar(var, is_rvar != 0), stage);
+    } else {
+      return false;
+    }
+    return true;
+  };
+
+  std::vector<FuncScheduleRecord> funcs;
+  std::istringstream lines(text);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream in(line);
+    std::string op;
+    if (!(in >> op) || op[0] == '#') {
+      continue;
+    }
+    if (op == "func") {
+      funcs.emplace_back();
+      in >> funcs.back().name;
+      if (!env.count(funcs.back().name)) {
+        return false;
+      }
+      continue;
+    } else if (funcs.empty()) {
+      return false;
+    }
+    FuncScheduleRecord &f = funcs.back();
+    if (op == "compute") {
+      if (!parse_level(in, f.compute)) {
+        return false;
+      }
+    } else if (op == "store") {
+      if (!parse_level(in, f.store)) {
+        return false;
+      }
+    } else if (op == "memory") {
+      int m;
+      in >> m;
+      f.memory = (MemoryType)m;
+    } else if (op == "storage") {
+      Internal::StorageDim d;
+      std::string alignment, fold;
+      in >> d.var >> alignment >> fold >> d.fold_forward;
+      d.alignment = parse_expr(alignment);
+      d.fold_factor = parse_expr(fold);
+      f.storage.push_back(d);
+    } else if (op == "stage") {
+      int stage;
+      in >> stage;
+      if (stage != (int)f.stages.size() ||
+          stage > (int)env[f.name].updates().size()) {
+        return false;
+      }
+      f.stages.emplace_back();
+    } else if (op == "split" && !f.stages.empty()) {
+      Internal::Split sp;
+      std::string factor;
+      int tail, type;
+      in >> sp.old_var >> sp.outer >> sp.inner >> factor >> sp.exact >> tail >>
+          type;
+      sp.factor = parse_expr(factor);
+      sp.tail = (TailStrategy)tail;
+      sp.split_type = (Internal::Split::SplitType)type;
+      f.stages.back().splits().push_back(sp);
+    } else if (op == "dim" && !f.stages.empty()) {
+      Internal::Dim d;
+      int for_type, device_api, dim_type;
+      in >> d.var >> for_type >> device_api >> dim_type;
+      d.for_type = (Internal::ForType)for_type;
+      d.device_api = (DeviceAPI)device_api;
+      d.dim_type = (Internal::DimType)dim_type;
+      f.stages.back().dims().push_back(d);
+    } else {
+      return false;
+    }
+  }
+
+  for (const FuncScheduleRecord &f : funcs) {
+    Internal::Function fn = env[f.name];
+    fn.schedule().compute_level() = f.compute;
+    fn.schedule().store_level() = f.store;
+    fn.schedule().memory_type() = f.memory;
+    fn.schedule().storage_dims() = f.storage;
+    for (size_t stage = 0; stage < f.stages.size(); stage++) {
+      Internal::StageSchedule &ss = stage == 0
+                                        ? fn.definition().schedule()
+                                        : fn.update(stage - 1).schedule();
+      ss.splits() = f.stages[stage].splits();
+      ss.dims() = f.stages[stage].dims();
+      ss.touched() = true;
+    }
+  }
+  return true;
+}
+
+// Directory of cached schedules, HL_SCHEDULE_CACHE or ./schedule_cache
+inline std::string schedule_cache_dir() {
+  const char *dir = getenv("HL_SCHEDULE_CACHE");
+  return dir ? dir : "schedule_cache";
+}
+
+inline std::string schedule_cache_path(const std::string &key) {
+  return schedule_cache_dir() + "/" + key + ".schedule";
+}
+
+// A cached schedule and the time the autoscheduler took to produce it
+struct CachedSchedule {
+  std::string text;
+  double auto_schedule_ms = 0;
+};
+
+inline bool load_schedule(const std::string &key, CachedSchedule &cached) {
+  std::ifstream in(schedule_cache_path(key));
+  std::string header, tag;
+  if (!in || !(in >> header >> tag >> cached.auto_schedule_ms) ||
+      header != "#" || tag != "auto_schedule_ms") {
+    return false;
+  }
+  std::ostringstream text;
+  text << in.rdbuf();
+  cached.text = text.str();
+  return !cached.text.empty();
+}
+
+inline void store_schedule(const std::string &key,
+                           const CachedSchedule &cached) {
+  if (!make_dirs(schedule_cache_dir())) {
+    return;
+  }
+  std::ofstream out(schedule_cache_path(key));
+  out << "# auto_schedule_ms " << cached.auto_schedule_ms << "\n"
+      << cached.text;
+}
+
+// Print the lines removed from and added to schedule `a` to get `b`
+inline void print_schedule_diff(const std::string &a, const std::string &b) {
+  auto split_lines = [](const std::string &t) {
+    std::vector<std::string> v;
+    std::istringstream in(t);
+    std::string line;
+    while (std::getline(in, line)) {
+      v.push_back(line);
+    }
+    return v;
+  };
+  std::vector<std::string> x = split_lines(a), y = split_lines(b);
+  const size_t n = x.size(), m = y.size();
+  // Longest common subsequence of lines, then walk it
+  std::vector<std::vector<int>> lcs(n + 1, std::vector<int>(m + 1, 0));
+  for (size_t i = n; i-- > 0;) {
+    for (size_t j = m; j-- > 0;) {
+      lcs[i][j] = x[i] == y[j] ? lcs[i + 1][j + 1] + 1
+                               : std::max(lcs[i + 1][j], lcs[i][j + 1]);
+    }
+  }
+  std::string func;
+  size_t i = 0, j = 0;
+  while (i < n || j < m) {
+    if (i < n && j < m && x[i] == y[j]) {
+      if (x[i].compare(0, 5, "func ") == 0) {
+        func = x[i];
+      }
+      i++, j++;
+    } else if (j < m && (i == n || lcs[i][j + 1] >= lcs[i + 1][j])) {
+      printf("  + %s (%s)\n", y[j++].c_str(), func.c_str());
+    } else {
+      printf("  - %s (%s)\n", x[i++].c_str(), func.c_str());
+    }
+  }
+}
+
+} // namespace HalideApps
+
+#endif
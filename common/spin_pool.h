@@ -0,0 +1,339 @@
+#ifndef COMMON_SPIN_POOL_H
+#define COMMON_SPIN_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "Halide.h"
+#include "HalideRuntime.h"
+#include "app_options.h"
+#include "bench_harness.h"
+
+namespace HalideApps {
+
+using namespace Halide;
+
+// A thread pool for parallel loops that take microseconds, installed with
+// set_custom_do_par_for in place of the Halide runtime's. Its workers are
+// pinned one per CPU, and after each loop they spin for a while before
+// going to sleep, so the next loop starts without waking anyone. A loop's
+// range is dealt out to the calling thread and the workers in contiguous
+// blocks; whoever runs out of its own block steals half of what is left of
+// another's. Loops nested in a task, or started while another thread's
+// loop runs, run inline.
+class SpinPool {
+public:
+  static SpinPool &instance() {
+    static SpinPool pool;
+    return pool;
+  }
+
+  // Start `threads - 1` workers, pinned to the CPUs of the process after the
+  // first, which spin for `spin_us` after each loop. Only the first call
+  // starts them.
+  void start(int threads, int spin_us) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!workers.empty() || threads < 2) {
+      return;
+    }
+    spin = std::chrono::microseconds(spin_us);
+    blocks = std::vector<Block>(threads);
+    const std::vector<int> cpus = allowed_cpus();
+    for (int w = 1; w < threads; w++) {
+      workers.emplace_back([this, w]() { work(w); });
+      if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[w % cpus.size()], &set);
+        pinned += pthread_setaffinity_np(workers.back().native_handle(),
+                                         sizeof(set), &set) == 0;
+      }
+    }
+  }
+
+  ~SpinPool() {
+    {
+      // Under the mutex, so no worker misses it between its check and wait
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : workers) {
+      t.join();
+    }
+  }
+
+  int threads() const { return (int)blocks.size(); }
+  int pinned_workers() const { return pinned; }
+  int spin_us() const { return (int)spin.count(); }
+
+  // Loops run, blocks stolen and workers put to sleep so far
+  struct Stats {
+    uint64_t loops = 0, steals = 0, sleeps = 0;
+  };
+  Stats stats() const {
+    Stats s;
+    s.loops = loops;
+    s.steals = steals;
+    s.sleeps = sleeps;
+    return s;
+  }
+
+  // Hook for set_custom_do_par_for
+  static int halide_do_par_for(void *user_context, halide_task_t f, int min,
+                               int size, uint8_t *closure) {
+    SpinPool &pool = instance();
+    if (pool.blocks.size() < 2 || size < 2 || in_worker() ||
+        pool.busy.exchange(true)) {
+      for (int i = min; i < min + size; i++) {
+        const int result = f(user_context, i, closure);
+        if (result != 0) {
+          return result;
+        }
+      }
+      return 0;
+    }
+    const int result = pool.run(user_context, f, min, size, closure);
+    pool.busy = false;
+    return result;
+  }
+
+private:
+  struct Job {
+    halide_task_t task;
+    void *context;
+    uint8_t *closure;
+    std::atomic<int> remaining{0}, result{0};
+  };
+
+  // Tasks [begin, end) of `job` left to one thread; others shrink it from
+  // the end when they steal. `epoch` is the loop the block was dealt for:
+  // a thread still draining an earlier loop leaves it alone.
+  struct alignas(64) Block {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    uint64_t epoch = 0;
+    Job *job = nullptr;
+    int begin = 0, end = 0;
+
+    void acquire() {
+      while (lock.test_and_set(std::memory_order_acquire)) {
+      }
+    }
+    void release() { lock.clear(std::memory_order_release); }
+  };
+
+  std::vector<Block> blocks;
+  std::vector<std::thread> workers;
+  std::chrono::microseconds spin{0};
+  int pinned = 0;
+  std::atomic<bool> busy{false};
+  // Moves on with every loop; workers wait for it to change
+  std::atomic<uint64_t> epoch{0};
+  std::atomic<int> sleeping{0};
+  std::atomic<uint64_t> loops{0}, steals{0}, sleeps{0};
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::atomic<bool> stopping{false};
+
+  SpinPool() {}
+
+  static bool &in_worker() {
+    static thread_local bool worker = false;
+    return worker;
+  }
+
+  int run(void *user_context, halide_task_t f, int min, int size,
+          uint8_t *closure) {
+    Job job;
+    job.task = f;
+    job.context = user_context;
+    job.closure = closure;
+    job.remaining = size;
+    const int n = (int)blocks.size();
+    const uint64_t e = epoch + 1;
+    for (int w = 0; w < n; w++) {
+      Block &b = blocks[w];
+      b.acquire();
+      b.epoch = e;
+      b.job = &job;
+      b.begin = min + (int)((int64_t)size * w / n);
+      b.end = min + (int)((int64_t)size * (w + 1) / n);
+      b.release();
+    }
+    loops++;
+    epoch = e;
+    if (sleeping > 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      wake.notify_all();
+    }
+    drain(0, e);
+    // The last tasks may still be running on workers
+    while (job.remaining.load(std::memory_order_acquire) > 0) {
+      std::this_thread::yield();
+    }
+    return job.result;
+  }
+
+  // Take the next task of block `w` in loop `e`, and its job
+  bool pop(int w, uint64_t e, Job *&job, int &index) {
+    Block &b = blocks[w];
+    b.acquire();
+    const bool found = b.epoch == e && b.begin < b.end;
+    if (found) {
+      index = b.begin++;
+      job = b.job;
+    }
+    b.release();
+    return found;
+  }
+
+  // Move the second half of what is left of block `victim` to block `w`,
+  // which is empty, if both are still dealt for loop `e`. Both are locked,
+  // the lower index first, so run() cannot deal either to the next loop
+  // while the tasks move between them.
+  bool steal(int victim, int w, uint64_t e) {
+    Block &v = blocks[victim], &b = blocks[w];
+    Block &first = victim < w ? v : b, &second = victim < w ? b : v;
+    first.acquire();
+    second.acquire();
+    const int left = v.end - v.begin;
+    const bool stolen = v.epoch == e && b.epoch == e && left >= 2;
+    if (stolen) {
+      b.job = v.job;
+      b.begin = v.begin + left / 2;
+      b.end = v.end;
+      v.end = b.begin;
+    }
+    second.release();
+    first.release();
+    if (stolen) {
+      steals++;
+    }
+    return stolen;
+  }
+
+  // Run tasks of loop `e` from block `w`, then from the blocks it steals
+  // from, until none are left. A task is the last use of its job by this
+  // thread.
+  void drain(int w, uint64_t e) {
+    const int n = (int)blocks.size();
+    while (true) {
+      Job *job = nullptr;
+      int index = 0;
+      if (!pop(w, e, job, index)) {
+        bool stolen = false;
+        for (int k = 1; k < n && !stolen; k++) {
+          stolen = steal((w + k) % n, w, e);
+        }
+        if (!stolen) {
+          return;
+        }
+        continue;
+      }
+      const int result = job->task(job->context, index, job->closure);
+      if (result != 0) {
+        job->result = result;
+      }
+      job->remaining.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  void work(int w) {
+    in_worker() = true;
+    uint64_t seen = 0;
+    while (true) {
+      if (epoch == seen) {
+        const auto until = std::chrono::steady_clock::now() + spin;
+        while (epoch == seen && !stopping &&
+               std::chrono::steady_clock::now() < until) {
+        }
+      }
+      if (epoch == seen) {
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping++;
+        sleeps++;
+        wake.wait(lock, [&]() { return stopping || epoch != seen; });
+        sleeping--;
+      }
+      if (stopping) {
+        return;
+      }
+      seen = epoch;
+      drain(w, seen);
+    }
+  }
+};
+
+// Per-call times of `op`, sorted, for at most `seconds` and `max_calls`
+// calls after `warmup` untimed ones
+template <typename F>
+std::vector<double> sample_calls(F op, int warmup, double seconds,
+                                 int max_calls) {
+  for (int i = 0; i < warmup; i++) {
+    op();
+  }
+  std::vector<double> ms;
+  const auto start = std::chrono::steady_clock::now();
+  while ((int)ms.size() < max_calls && ms_since(start) < seconds * 1e3) {
+    const auto t = std::chrono::steady_clock::now();
+    op();
+    ms.push_back(ms_since(t));
+  }
+  std::sort(ms.begin(), ms.end());
+  return ms;
+}
+
+// With --spin-pool=on, time single calls of `op` with its parallel loops on
+// the Halide thread pool and then on the SpinPool, switching between them
+// with `use` (null for the Halide pool), and report the p50 and p99 of each.
+// CPU targets only: GPU kernels do not run on the thread pool.
+template <typename F>
+void compare_thread_pools(const AppOptions &opts, const Target &target,
+                          std::function<void(halide_do_par_for_t)> use,
+                          F op) {
+  if (!opts.spin_pool) {
+    return;
+  }
+  if (target.has_gpu_feature()) {
+    printf("Thread pools: CPU targets only\n");
+    return;
+  }
+  SpinPool &pool = SpinPool::instance();
+  pool.start(available_threads(), opts.spin_us);
+  const double seconds = std::min(1.0, opts.bench_seconds);
+  use(nullptr);
+  const std::vector<double> halide =
+      sample_calls(op, opts.warmup, seconds, 100000);
+  use(SpinPool::halide_do_par_for);
+  const SpinPool::Stats before = pool.stats();
+  const std::vector<double> spin =
+      sample_calls(op, opts.warmup, seconds, 100000);
+  const SpinPool::Stats after = pool.stats();
+  use(nullptr);
+  const double calls = std::max<size_t>(1, spin.size());
+  printf("Thread pools: Halide p50 %.4gms, p99 %.4gms; spin pool of %d "
+         "(%d pinned, %dus spin) p50 %.4gms, p99 %.4gms, %.2f loops, %.2f "
+         "steals and %.2f sleeps per call\n",
+         percentile(halide, 0.5), percentile(halide, 0.99), pool.threads(),
+         pool.pinned_workers(), pool.spin_us(), percentile(spin, 0.5),
+         percentile(spin, 0.99), (after.loops - before.loops) / calls,
+         (after.steals - before.steals) / calls,
+         (after.sleeps - before.sleeps) / calls);
+}
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,254 @@
+#ifndef COMMON_STAGE_PROFILER_H
+#define COMMON_STAGE_PROFILER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace HalideApps {
+
+// Directory of profile reports, HL_PROFILE_DIR or ./profile
+inline std::string profile_dir() {
+  const char *dir = getenv("HL_PROFILE_DIR");
+  return dir ? dir : "profile";
+}
+
+// One Func of a profiled pipeline, summed over the reports of its runs
+struct StageProfile {
+  std::string name;
+  double time_ms = 0;      // total over all runs
+  double thread_ms = 0;    // time_ms weighted by the threads used
+  uint64_t peak_bytes = 0; // largest heap allocation peak of a run
+  uint64_t allocations = 0;
+  uint64_t stack_bytes = 0;
+};
+
+// A profiled pipeline, summed over the reports of its runs
+struct PipelineProfile {
+  std::string name;
+  int runs = 0;
+  double time_ms = 0;
+  double thread_ms = 0;
+  uint64_t allocations = 0;
+  uint64_t peak_bytes = 0;
+  std::vector<StageProfile> stages;
+
+  StageProfile &stage(const std::string &n) {
+    for (StageProfile &s : stages) {
+      if (s.name == n) {
+        return s;
+      }
+    }
+    stages.emplace_back();
+    stages.back().name = n;
+    return stages.back();
+  }
+};
+
+// Collects the reports the Halide profiler prints after every realization
+// of a pipeline compiled with Target::Profile, through a custom print hook,
+// and sums them per pipeline and Func. Pipelines are named by the label
+// given to begin() before they run, or else by the name in their report.
+// The reports are text meant for people; this parses the fields of each
+// line by their labels:
+//
+//   <pipeline>
+//    total time: 1.2 ms  samples: 12  runs: 1  time/run: 1.2 ms
+//    average threads used: 7.6
+//    heap allocations: 4  peak heap usage: 1048576 bytes
+//     <func>: 0.8ms (66%) threads: 7.9 peak: 524288 num: 2 avg: 262144
+class StageProfiler {
+public:
+  static StageProfiler &instance() {
+    static StageProfiler profiler;
+    return profiler;
+  }
+
+  // Hook for Pipeline::set_custom_print. Complete lines are parsed as they
+  // arrive, so that the reports of a long benchmark do not pile up.
+  static void halide_print(void *, const char *msg) {
+    StageProfiler &p = instance();
+    std::lock_guard<std::mutex> lock(p.mutex);
+    p.pending += msg;
+    size_t start = 0, end;
+    while ((end = p.pending.find('\n', start)) != std::string::npos) {
+      p.parse(p.pending.substr(start, end - start));
+      start = end + 1;
+    }
+    p.pending.erase(0, start);
+  }
+
+  // Attribute the reports printed from now on to `label`
+  void begin(const std::string &l) {
+    std::lock_guard<std::mutex> lock(mutex);
+    label = l;
+  }
+
+  // Drop everything collected so far
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+    label.clear();
+    current = -1;
+    pipelines.clear();
+  }
+
+  // Parse what remains of the reports printed so far
+  void collect() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!pending.empty()) {
+      parse(pending);
+      pending.clear();
+    }
+  }
+
+  bool empty() const { return pipelines.empty(); }
+
+  // JSON report of everything collected, with `fields` (already JSON
+  // values) at the top level
+  std::string json(const std::map<std::string, std::string> &fields) const {
+    std::ostringstream s;
+    s << "{\n";
+    for (auto &it : fields) {
+      s << "  " << quote(it.first) << ": " << it.second << ",\n";
+    }
+    s << "  \"pipelines\": [";
+    for (size_t i = 0; i < pipelines.size(); i++) {
+      const PipelineProfile &p = pipelines[i];
+      const int runs = std::max(1, p.runs);
+      s << (i ? ",\n" : "\n") << "    {\n"
+        << "      \"name\": " << quote(p.name) << ",\n"
+        << "      \"runs\": " << p.runs << ",\n"
+        << "      \"time_per_run_ms\": " << p.time_ms / runs << ",\n"
+        << "      \"average_threads\": " << threads(p.thread_ms, p.time_ms)
+        << ",\n"
+        << "      \"heap_allocations_per_run\": "
+        << double(p.allocations) / runs << ",\n"
+        << "      \"peak_heap_bytes\": " << p.peak_bytes << ",\n"
+        << "      \"stages\": [";
+      std::vector<StageProfile> stages = p.stages;
+      std::sort(stages.begin(), stages.end(),
+                [](const StageProfile &a, const StageProfile &b) {
+                  return a.time_ms > b.time_ms;
+                });
+      for (size_t j = 0; j < stages.size(); j++) {
+        const StageProfile &st = stages[j];
+        s << (j ? ",\n" : "\n") << "        {\"name\": " << quote(st.name)
+          << ", \"time_per_run_ms\": " << st.time_ms / runs
+          << ", \"percent\": "
+          << (p.time_ms > 0 ? 100 * st.time_ms / p.time_ms : 0)
+          << ", \"threads\": " << threads(st.thread_ms, st.time_ms)
+          << ", \"peak_bytes\": " << st.peak_bytes
+          << ", \"allocations_per_run\": " << double(st.allocations) / runs
+          << ", \"stack_bytes\": " << st.stack_bytes << "}";
+      }
+      s << "\n      ]\n    }";
+    }
+    s << "\n  ]\n}\n";
+    return s.str();
+  }
+
+  static std::string quote(const std::string &v) {
+    std::string q = "\"";
+    for (char c : v) {
+      if (c == '"' || c == '\\') {
+        q += '\\';
+      }
+      q += c;
+    }
+    return q + "\"";
+  }
+
+private:
+  std::mutex mutex;
+  // The end of a report line not printed yet, and the label of begin()
+  std::string pending, label;
+  std::vector<PipelineProfile> pipelines;
+  // Parser state: the pipeline of the report being read, its runs, which
+  // the Func times are per run of, and its total time
+  int current = -1;
+  int runs = 1;
+  double ms = 0;
+
+  int pipeline(const std::string &name) {
+    for (size_t i = 0; i < pipelines.size(); i++) {
+      if (pipelines[i].name == name) {
+        return (int)i;
+      }
+    }
+    pipelines.emplace_back();
+    pipelines.back().name = name;
+    return (int)pipelines.size() - 1;
+  }
+
+  void parse(const std::string &line) {
+    std::vector<std::string> t = tokens(line);
+    if (t.empty()) {
+      return;
+    } else if (line[0] != ' ') {
+      current = pipeline(label.empty() ? t[0] : label);
+      return;
+    } else if (current < 0) {
+      return;
+    }
+    PipelineProfile *p = &pipelines[current];
+    if (t[0] == "total" && t.size() >= 3) {
+      ms = atof(t[2].c_str());
+      runs = std::max(1, atoi(value(t, "runs:").c_str()));
+      p->time_ms += ms;
+      p->thread_ms += ms;
+      p->runs += runs;
+    } else if (t[0] == "average") {
+      p->thread_ms += (atof(value(t, "used:").c_str()) - 1) * ms;
+    } else if (t[0] == "heap") {
+      p->allocations += atoll(value(t, "allocations:").c_str());
+      p->peak_bytes = std::max<uint64_t>(
+          p->peak_bytes, atoll(value(t, "usage:").c_str()));
+    } else if (t[0].back() == ':' && t.size() >= 2) {
+      StageProfile &s = p->stage(t[0].substr(0, t[0].size() - 1));
+      const double stage_ms = atof(t[1].c_str()) * runs;
+      const std::string threads = value(t, "threads:");
+      s.time_ms += stage_ms;
+      s.thread_ms += stage_ms * (threads.empty() ? 1 : atof(threads.c_str()));
+      s.peak_bytes =
+          std::max<uint64_t>(s.peak_bytes, atoll(value(t, "peak:").c_str()));
+      s.allocations += atoll(value(t, "num:").c_str());
+      s.stack_bytes =
+          std::max<uint64_t>(s.stack_bytes, atoll(value(t, "stack:").c_str()));
+    }
+  }
+
+  static std::vector<std::string> tokens(const std::string &line) {
+    std::vector<std::string> t;
+    std::istringstream in(line);
+    std::string w;
+    while (in >> w) {
+      t.push_back(w);
+    }
+    return t;
+  }
+
+  // The token after `label`, or "" if there is none
+  static std::string value(const std::vector<std::string> &t,
+                           const std::string &label) {
+    for (size_t i = 0; i + 1 < t.size(); i++) {
+      if (t[i] == label) {
+        return t[i + 1];
+      }
+    }
+    return "";
+  }
+
+  static double threads(double thread_ms, double ms) {
+    return ms > 0 ? thread_ms / ms : 0;
+  }
+};
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef COMMON_TASK_TRACER_H
+#define COMMON_TASK_TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "HalideRuntime.h"
+
+namespace HalideApps {
+
+// Directory of trace files, HL_TRACE_DIR or ./trace
+inline std::string trace_dir() {
+  const char *dir = getenv("HL_TRACE_DIR");
+  return dir ? dir : "trace";
+}
+
+// Records when each task of a parallel loop ran, and on which thread, while
+// recording is on. Pipelines route their tasks through halide_do_task; the
+// caller marks the pieces of work it realizes, which become spans on its
+// own thread. write() exports everything as a Chrome trace, which Perfetto
+// and chrome://tracing open, with one track per thread:
+//
+//   tracer.start();
+//   tracer.mark("interior"); ... tracer.mark("border"); ...
+//   tracer.stop();
+//   tracer.write(path, {{"app", "\"Sobel\""}});
+//
+// Halide names no loop at run time, so tasks are named by the address of
+// the loop body, which tells the parallel loops of a pipeline apart.
+class TaskTracer {
+public:
+  static TaskTracer &instance() {
+    static TaskTracer tracer;
+    return tracer;
+  }
+
+  // Hook for Pipeline::set_custom_do_task; runs the task like Halide's
+  // default does, timing it when recording
+  static int halide_do_task(void *user_context, halide_task_t f, int idx,
+                            uint8_t *closure) {
+    TaskTracer &t = instance();
+    if (!t.recording) {
+      return f(user_context, idx, closure);
+    }
+    const double start = t.now_us();
+    const int result = f(user_context, idx, closure);
+    const double end = t.now_us();
+    char name[64];
+    snprintf(name, sizeof(name), "task %p", (void *)f);
+    t.add({name, thread_id(), start, end, idx});
+    return result;
+  }
+
+  void start() {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.clear();
+    open_mark.clear();
+    main_thread = thread_id();
+    origin = std::chrono::steady_clock::now();
+    recording = true;
+  }
+
+  // End the current piece of work of the calling thread, if any, and begin
+  // one named `label`
+  void mark(const std::string &label) {
+    if (!recording) {
+      return;
+    }
+    close_mark();
+    mark_start = now_us();
+    open_mark = label;
+  }
+
+  void stop() {
+    close_mark();
+    recording = false;
+  }
+
+  size_t tasks() const {
+    size_t n = 0;
+    for (const Event &e : events) {
+      n += e.index >= 0;
+    }
+    return n;
+  }
+
+  // Write the events recorded between start() and stop() as a Chrome trace,
+  // with `fields` (already JSON values) as its metadata
+  bool write(const std::string &path,
+             const std::map<std::string, std::string> &fields) const {
+    std::map<long, int> threads; // thread id -> track, in order of first use
+    threads[main_thread] = 0;
+    for (const Event &e : events) {
+      threads.emplace(e.thread, (int)threads.size());
+    }
+    std::ostringstream s;
+    s << "{\n  \"displayTimeUnit\": \"ms\",\n  \"metadata\": {";
+    const char *sep = "\n";
+    for (auto &it : fields) {
+      s << sep << "    \"" << it.first << "\": " << it.second;
+      sep = ",\n";
+    }
+    s << "\n  },\n  \"traceEvents\": [";
+    sep = "\n";
+    for (auto &it : threads) {
+      s << sep << "    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+        << "\"tid\": " << it.second << ", \"args\": {\"name\": \""
+        << (it.second == 0 ? std::string("caller")
+                           : "worker " + std::to_string(it.second))
+        << "\"}}";
+      sep = ",\n";
+    }
+    for (const Event &e : events) {
+      s << ",\n    {\"name\": \"" << e.name << "\", \"ph\": \"X\", "
+        << "\"pid\": 1, \"tid\": " << threads[e.thread]
+        << ", \"ts\": " << e.start << ", \"dur\": " << e.end - e.start;
+      if (e.index >= 0) {
+        s << ", \"args\": {\"index\": " << e.index << "}";
+      }
+      s << "}";
+    }
+    s << "\n  ]\n}\n";
+    std::ofstream out(path);
+    out << s.str();
+    return (bool)out;
+  }
+
+private:
+  struct Event {
+    std::string name;
+    long thread;
+    double start, end; // us since start()
+    int index;         // of the task in its loop, -1 for marked spans
+  };
+
+  std::mutex mutex;
+  std::atomic<bool> recording{false};
+  std::chrono::steady_clock::time_point origin;
+  std::vector<Event> events;
+  std::string open_mark;
+  double mark_start = 0;
+  long main_thread = 0;
+
+  static long thread_id() { return syscall(SYS_gettid); }
+
+  double now_us() const {
+    std::chrono::duration<double, std::micro> d =
+        std::chrono::steady_clock::now() - origin;
+    return d.count();
+  }
+
+  void add(const Event &e) {
+    std::lock_guard<std::mutex> lock(mutex);
+    events.push_back(e);
+  }
+
+  void close_mark() {
+    if (!open_mark.empty()) {
+      add({open_mark, thread_id(), mark_start, now_us(), -1});
+      open_mark.clear();
+    }
+  }
+};
+
+} // namespace HalideApps
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Runs every app on the CPU under each autoscheduler and set of machine
+# parameters, and prints one markdown table of schedule and run times.
+#
+# usage: scripts/compare_autoschedulers.sh [app...]
+# Extra app options can be passed in ARGS.
+
+cd "$(dirname "$0")/.." || exit 1
+
+APPS=${*:-Bilateral Gaussian HarrisCorner ImageEnhance ImageMosaics \
+ImagePyramid Laplace NightFilter NightFilterPipeline Prewitt \
+ShiTomasiFeature Sobel Unsharp}
+SCHEDULERS="Mullapudi2016 Li2018 Adams2019"
+
+# Machine parameters: the autoscheduler defaults, then all cores and half of
+# them with the measured last-level cache, then a small cache
+CORES=$(nproc)
+LLC=$(getconf LEVEL3_CACHE_SIZE 2>/dev/null)
+[ -z "$LLC" ] || [ "$LLC" -eq 0 ] && LLC=$((16 * 1024 * 1024))
+PARAMS=("" "$CORES,$LLC,40" "$((CORES / 2 > 0 ? CORES / 2 : 1)),$LLC,40"
+        "$CORES,$((LLC / 4)),40")
+
+echo "| app | autoscheduler | machine params | schedule (ms) | run (ms) |"
+echo "|:--- |:------------- |:-------------- | -------------:| --------:|"
+for app in $APPS; do
+  for scheduler in $SCHEDULERS; do
+    for params in "${PARAMS[@]}"; do
+      opts="--target=host --split=off --schedule=auto --schedule-cache=off"
+      opts="$opts --autoscheduler=$scheduler ${ARGS}"
+      [ -n "$params" ] && opts="$opts --machine-params=$params"
+      out=$(make -s -C "$app" -f ../Makefile test ARGS="$opts" 2>&1)
+      sched=$(echo "$out" | sed -n 's/^Scheduled with .* in \([0-9.]*\)ms$/\1/p' |
+              awk '{ s += $1 } END { if (NR) print s; else print "-" }')
+      run=$(echo "$out" | sed -n 's/^Auto-tuned time .*: \([0-9.e+-]*\)ms$/\1/p' |
+            head -n 1)
+      echo "| $app | $scheduler | ${params:-generic} | $sched | ${run:-failed} |"
+    done
+  done
+done